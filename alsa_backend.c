@@ -0,0 +1,264 @@
+/*
+ * AUDIO BACKEND: DIRECT ALSA MMAP
+ * Drives capture and playback PCMs ourselves instead of going through PortAudio.
+ * Each period is read straight out of the capture DMA ring and the effect chain
+ * writes its output straight into the playback DMA ring, so there are no extra
+ * buffers or copies between the hardware and the effects.
+ * Only built with -DUSE_ALSA_MMAP (link with -lasound).
+ *
+ * To test without hardware, any PCM name ALSA understands will do:
+ *   snd-aloop:  modprobe snd-aloop, then use hw:Loopback,0 and hw:Loopback,1
+ *   null:       use "null" for both, everything is discarded/silent
+ *   file:       define a pcm of type "file" in ~/.asoundrc that slaves to null
+ */
+#define ALSA_PERIODS (2)
+// how long to block in snd_pcm_wait before checking whether we should stop
+#define ALSA_WAIT_MS (100)
+
+// signature shared by everything that can sit behind a backend
+typedef void (*BlockProcessor)(void* data, const float* in, float* out, unsigned long frames);
+
+typedef struct {
+	snd_pcm_t* capture;
+	snd_pcm_t* playback;
+	int sampleRate;
+	int periodSize;
+	int inChannels;
+	int outChannels;
+
+	BlockProcessor process;
+	void* data;
+
+	// set when a side of the hardware won't give us float samples directly
+	bool inConvert;
+	bool outConvert;
+	float* inScratch;
+	float* outScratch;
+
+	// xruns are counted here, like PortAudio's are by its callback; NULL to not count them
+	Realtime* rt;
+
+	pthread_t thread;
+	volatile bool running;
+}
+AlsaBackend;
+
+static int alsaConfigure(snd_pcm_t* pcm, int sampleRate, int periodSize, int channels,
+						 bool wakeups, bool* convert) {
+	snd_pcm_hw_params_t* hw;
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_hw_params_any(pcm, hw);
+	int err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+	if (err < 0) return err;
+	// float lets the effects run directly on the ring, 16 bit is the fallback
+	*convert = false;
+	if (snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_FLOAT_LE) < 0) {
+		*convert = true;
+		err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16_LE);
+		if (err < 0) return err;
+	}
+	err = snd_pcm_hw_params_set_channels(pcm, hw, channels);
+	if (err < 0) return err;
+	unsigned int rate = sampleRate;
+	err = snd_pcm_hw_params_set_rate(pcm, hw, rate, 0);
+	if (err < 0) return err;
+	snd_pcm_uframes_t period = periodSize;
+	err = snd_pcm_hw_params_set_period_size(pcm, hw, period, 0);
+	if (err < 0) return err;
+	// two periods is the least that still lets us fill one while the other plays
+	err = snd_pcm_hw_params_set_periods(pcm, hw, ALSA_PERIODS, 0);
+	if (err < 0) return err;
+	// only the side we wait on needs period interrupts
+	if (!wakeups) {
+		snd_pcm_hw_params_set_period_wakeup(pcm, hw, 0);
+	}
+	err = snd_pcm_hw_params(pcm, hw);
+	if (err < 0) return err;
+
+	snd_pcm_sw_params_t* sw;
+	snd_pcm_sw_params_alloca(&sw);
+	snd_pcm_sw_params_current(pcm, sw);
+	// wake up once per period, and only start when we say so
+	snd_pcm_sw_params_set_avail_min(pcm, sw, periodSize);
+	snd_pcm_sw_params_set_start_threshold(pcm, sw, periodSize * ALSA_PERIODS * 2);
+	return snd_pcm_sw_params(pcm, sw);
+}
+
+AlsaBackend* AlsaBackend_create(const char* captureName, const char* playbackName,
+								int _sampleRate, int _periodSize, int _inChannels, int _outChannels,
+								BlockProcessor _process, void* _data, Realtime* _rt) {
+	AlsaBackend* alsa = (AlsaBackend*)malloc(sizeof(AlsaBackend));
+	alsa->sampleRate = _sampleRate;
+	alsa->periodSize = _periodSize;
+	alsa->inChannels = _inChannels;
+	alsa->outChannels = _outChannels;
+	alsa->process = _process;
+	alsa->data = _data;
+	alsa->rt = _rt;
+	alsa->running = false;
+
+	int err = snd_pcm_open(&alsa->capture, captureName, SND_PCM_STREAM_CAPTURE, 0);
+	if (err < 0) {
+		fprintf(stderr, "could not open %s: %s\n", captureName, snd_strerror(err));
+		free(alsa);
+		return NULL;
+	}
+	err = snd_pcm_open(&alsa->playback, playbackName, SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0) {
+		fprintf(stderr, "could not open %s: %s\n", playbackName, snd_strerror(err));
+		snd_pcm_close(alsa->capture);
+		free(alsa);
+		return NULL;
+	}
+	if ((err = alsaConfigure(alsa->capture, alsa->sampleRate, alsa->periodSize, alsa->inChannels,
+							 true, &alsa->inConvert)) < 0 ||
+		(err = alsaConfigure(alsa->playback, alsa->sampleRate, alsa->periodSize, alsa->outChannels,
+							 false, &alsa->outConvert)) < 0) {
+		fprintf(stderr, "could not configure ALSA: %s\n", snd_strerror(err));
+		snd_pcm_close(alsa->capture);
+		snd_pcm_close(alsa->playback);
+		free(alsa);
+		return NULL;
+	}
+	alsa->inScratch = (float*)malloc(sizeof(float) * alsa->periodSize * alsa->inChannels);
+	alsa->outScratch = (float*)malloc(sizeof(float) * alsa->periodSize * alsa->outChannels);
+	// starting capture starts playback too, so both rings stay in step
+	if (snd_pcm_link(alsa->capture, alsa->playback) < 0) {
+		fprintf(stderr, "could not link capture and playback, they may drift\n");
+	}
+	return alsa;
+}
+
+static void* alsaAddress(const snd_pcm_channel_area_t* area, snd_pcm_uframes_t offset) {
+	return (char*)area->addr + (area->first + offset * area->step) / 8;
+}
+
+// one period of silence in playback is all the cushion we keep
+static int alsaPrime(AlsaBackend* alsa) {
+	const snd_pcm_channel_area_t* areas;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t frames = alsa->periodSize;
+	int err = snd_pcm_mmap_begin(alsa->playback, &areas, &offset, &frames);
+	if (err < 0) return err;
+	snd_pcm_areas_silence(areas, offset, alsa->outChannels, frames,
+						  alsa->outConvert ? SND_PCM_FORMAT_S16_LE : SND_PCM_FORMAT_FLOAT_LE);
+	snd_pcm_sframes_t committed = snd_pcm_mmap_commit(alsa->playback, offset, frames);
+	if (committed < 0) return committed;
+	return snd_pcm_start(alsa->capture);
+}
+
+static int alsaRecover(AlsaBackend* alsa) {
+	if (alsa->rt != NULL) {
+		Realtime_xrun(alsa->rt);
+	}
+	snd_pcm_drop(alsa->capture);
+	snd_pcm_drop(alsa->playback);
+	snd_pcm_prepare(alsa->capture);
+	snd_pcm_prepare(alsa->playback);
+	return alsaPrime(alsa);
+}
+
+static void alsaRunPeriod(AlsaBackend* alsa, float* in, float* out, snd_pcm_uframes_t frames) {
+	// 16 bit hardware goes through the scratch buffers, float is processed in place
+	float* processIn = in;
+	float* processOut = out;
+	if (alsa->inConvert) {
+		short* inShort = (short*)in;
+		for (unsigned int i = 0; i < frames * alsa->inChannels; ++i) {
+			alsa->inScratch[i] = inShort[i] / 32768.0f;
+		}
+		processIn = alsa->inScratch;
+	}
+	if (alsa->outConvert) {
+		processOut = alsa->outScratch;
+	}
+	alsa->process(alsa->data, processIn, processOut, frames);
+	if (alsa->outConvert) {
+		short* outShort = (short*)out;
+		for (unsigned int i = 0; i < frames * alsa->outChannels; ++i) {
+			float sample = alsa->outScratch[i] * 32768.0f;
+			sample = sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample);
+			outShort[i] = (short)sample;
+		}
+	}
+}
+
+static void* alsaThread(void* _alsa) {
+	AlsaBackend* alsa = (AlsaBackend*)_alsa;
+	if (alsaPrime(alsa) < 0) {
+		fprintf(stderr, "could not start ALSA streams\n");
+		return NULL;
+	}
+	while (alsa->running) {
+		int err = snd_pcm_wait(alsa->capture, ALSA_WAIT_MS);
+		if (err == 0) {
+			continue;
+		}
+		snd_pcm_sframes_t captureAvail = snd_pcm_avail_update(alsa->capture);
+		snd_pcm_sframes_t playbackAvail = snd_pcm_avail_update(alsa->playback);
+		if (err < 0 || captureAvail < 0 || playbackAvail < 0) {
+			alsaRecover(alsa);
+			continue;
+		}
+		while (captureAvail >= alsa->periodSize && playbackAvail >= alsa->periodSize) {
+			const snd_pcm_channel_area_t* captureAreas;
+			const snd_pcm_channel_area_t* playbackAreas;
+			snd_pcm_uframes_t captureOffset, playbackOffset;
+			snd_pcm_uframes_t captureFrames = alsa->periodSize;
+			snd_pcm_uframes_t playbackFrames = alsa->periodSize;
+			if (snd_pcm_mmap_begin(alsa->capture, &captureAreas, &captureOffset, &captureFrames) < 0 ||
+				snd_pcm_mmap_begin(alsa->playback, &playbackAreas, &playbackOffset, &playbackFrames) < 0) {
+				alsaRecover(alsa);
+				break;
+			}
+			// the rings can wrap at different points, only do what both can take
+			snd_pcm_uframes_t frames = captureFrames < playbackFrames ? captureFrames : playbackFrames;
+			alsaRunPeriod(alsa,
+						  (float*)alsaAddress(&captureAreas[0], captureOffset),
+						  (float*)alsaAddress(&playbackAreas[0], playbackOffset),
+						  frames);
+			if (snd_pcm_mmap_commit(alsa->capture, captureOffset, frames) < 0 ||
+				snd_pcm_mmap_commit(alsa->playback, playbackOffset, frames) < 0) {
+				alsaRecover(alsa);
+				break;
+			}
+			captureAvail -= frames;
+			playbackAvail -= frames;
+		}
+	}
+	snd_pcm_drop(alsa->capture);
+	snd_pcm_drop(alsa->playback);
+	return NULL;
+}
+
+int AlsaBackend_start(AlsaBackend* alsa) {
+	alsa->running = true;
+	if (pthread_create(&alsa->thread, NULL, alsaThread, alsa) != 0) {
+		alsa->running = false;
+		return -1;
+	}
+	return 0;
+}
+
+void AlsaBackend_stop(AlsaBackend* alsa) {
+	if (!alsa->running) {
+		return;
+	}
+	alsa->running = false;
+	pthread_join(alsa->thread, NULL);
+}
+
+// total frames between capture and playback, for comparing with PortAudio's numbers
+double AlsaBackend_getLatency(AlsaBackend* alsa) {
+	return (double)alsa->periodSize * ALSA_PERIODS / alsa->sampleRate;
+}
+
+void AlsaBackend_destroy(AlsaBackend* alsa) {
+	AlsaBackend_stop(alsa);
+	snd_pcm_unlink(alsa->capture);
+	snd_pcm_close(alsa->capture);
+	snd_pcm_close(alsa->playback);
+	free(alsa->inScratch);
+	free(alsa->outScratch);
+	free(alsa);
+}
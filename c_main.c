@@ -1,75 +1,197 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <pigpio.h>
 #include "portaudio.h"
 #include "pa_linux_alsa.h"
+#ifdef USE_ALSA_MMAP
+#include <alsa/asoundlib.h>
+#endif
 #include "math.h"
 #include "time.h"
 
+#include "lutmath.c"
 #include "utility.c"
 #include "sensor.c"
+#include "realtime.c"
+#include "pitch.c"
 #include "effects.c"
+#include "engine.c"
+#include "tuner.c"
+#include "wav.c"
+#include "recorder.c"
+#ifdef USE_ALSA_MMAP
+#include "alsa_backend.c"
+#endif
 
 #define SAMPLE_RATE (44100)
 #define ADJUSTED_SAMPLE_RATE (88200)
+// one chain per input channel, --channels changes these
 #define IN_CHANNELS (1)
 #define OUT_CHANNELS (1)
+// default chunk size, overridden by a saved calibration if there is one
 #define CHUNK_SIZE (128)
+// no backend hands the chains more than this at once
+#define MAX_CHUNK_SIZE (1024)
 
 #define GAIN_MIN (0)
 #define GAIN_MAX (1)
 #define DISTORT_MIN (0.2f)
 #define DISTORT_MAX (0.8f)
+// how far along the curve bank the distortion hand morphs, soft clip up to foldback
+#define DISTORT_SHAPE_MIN (DIST_SOFT)
+#define DISTORT_SHAPE_MAX (DIST_FOLD)
 #define DELAYSAMPS_MIN (0)
 #define DELAYSAMPS_MAX (SAMPLE_RATE * 0.7f)
 #define DELAYFDBK_MIN (0)
 #define DELAYFDBK_MAX (0.9f)
 #define VOICES (4)
+#define FILTER_SECTIONS (2)
+#define CUTOFF_MIN (300.0f)
+#define CUTOFF_MAX (12000.0f)
+#define DECAY_MIN (0.3f)
+#define DECAY_MAX (6.0f)
+#define REVERB_DAMPING (0.3f)
+#define REVERB_MIX (0.25f)
+#define CHORUS_VOICES (3)
+// effective speed of sound for the doppler, in cm/s
+#define DOPPLER_SOUND_SPEED (1500.0f)
+#define FREQSHIFT_HZ (100.0f)
+// the looper's backing file and the longest loop it can hold
+#define LOOP_FILE "loop.raw"
+// the loop files of the chains after the first
+#define LOOP_FILE_CHAIN "loop%d.raw"
+#define LOOP_SECONDS (10 * 60)
+#define LOOP_MIX (0.8f)
+// a hand closer than this to sensor 3 is a looper gesture, in cm
+#define LOOP_GESTURE_DIST (9)
+// the output limiter's ceiling, lookahead and recovery, just under full scale
+#define LIMITER_THRESHOLD (0.9f)
+#define LIMITER_LOOKAHEAD (0.0015f)
+#define LIMITER_RELEASE (0.1f)
+// RMS compressor settings, in dB and seconds
+#define COMP_THRESHOLD (-18.0f)
+#define COMP_RATIO (3.0f)
+#define COMP_ATTACK (0.005f)
+#define COMP_RELEASE (0.15f)
+#define COMP_MAKEUP (3.0f)
+// range of the input pitch tracker, in Hz
+#define PITCH_MIN_FREQ (40.0f)
+#define PITCH_MAX_FREQ (1500.0f)
+// harmonizer worker threads, 0 runs every voice in the callback, see --harm-workers
+#define HARM_WORKERS (0)
+// extra latency the voices may have so the workers get a whole block, in seconds
+#define HARM_LATENCY_BUDGET (0.0f)
+// with --key, the voices are these scale degrees above the played note instead:
+// a fifth, an octave, a third and a sixth, like the semitone shifts
+#define KEY_DEGREES {4, 7, 2, 5}
+// file space to reserve for a recording, one long set
+#define RECORD_PREALLOC_SECONDS (2 * 60 * 60)
+// sensor loop iterations between jitter reports (~6 s)
+#define REPORT_LOOPS (100)
+// each chain's harmony, delay and distortion sensors, as trigger and echo pins.
+// chain i reads set i, so every chain up to SENSOR_SETS needs its set wired.
+// the first is the original wiring and the second keeps clear of the I2S pins;
+// the third needs the UART and SPI off. later chains keep their starting settings
+#define SENSOR_SETS (3)
+static const int sensorPins[SENSOR_SETS][6] = {
+	{5, 6, 17, 27, 23, 24},
+	{12, 13, 16, 26, 22, 25},
+	{4, 14, 15, 7, 8, 9},
+};
 
-// callback function that processes one block of audio samples at a time
+// one performer's sensors and where their hands were last time round
+typedef struct {
+	Sensor* sensor1;
+	Sensor* sensor2;
+	Sensor* sensor3;
+	Gesture* loopGesture;
+	float lastDist1;
+	float lastDist2;
+	float lastDist3;
+	int lastZone;
+	bool halfSpeed;
+}
+Controls;
+
+static Realtime* realtime;
+static Tuning tuning = {CHUNK_SIZE, 0};
+static Recorder* recorder = NULL;
+static int inChannels = IN_CHANNELS;
+static int outChannels = OUT_CHANNELS;
+
+// processes one block of audio samples at a time, whichever backend is driving
+static void processBlock(void* _engine, const float* in, float* out, unsigned long frames) {
+	Realtime_callbackStart(realtime);
+	Engine_process((Engine*)_engine, in, out, frames);
+	if (recorder != NULL) {
+		Recorder_push(recorder, Engine_getMonitor((Engine*)_engine, out), frames);
+	}
+	Realtime_callbackEnd(realtime);
+}
+
+// PortAudio callback
 static int audioCallback(const void *inputBuffer,
 						 void *outputBuffer,
 						 unsigned long framesPerBuffer,
 						 const PaStreamCallbackTimeInfo* timeInfo,
 						 PaStreamCallbackFlags statusFlags,
-						 void *_fx) {
-	// assign typed references to effects data, input/output buffers
-	Effects* fx = (Effects*)_fx;
-	float *in = (float*)inputBuffer;
-	float *out = (float*)outputBuffer;
-	// loop through samples, do stuff to them
-	for (unsigned int i = 0; i < framesPerBuffer; ++i) {
-		*out = *in;
-		if (fx->gain->active) {
-			*out = Gain_apply(fx->gain, *out);
-		}
-		if (fx->harmonizer->active) {
-			*out = Harmonizer_apply(fx->harmonizer, *out);
-		}
-		if (fx->delay->active) {
-			*out = Delay_apply(fx->delay, *out);
-		}
-		if (fx->distortion->active) {
-			*out = Distortion_apply(fx->distortion, *out);
-		}
-		
-		// increment in and out pointers
-		in++;
-		out++;
+						 void *_engine) {
+	if (statusFlags & (paInputOverflow | paOutputUnderflow)) {
+		Realtime_xrun(realtime);
 	}
+	processBlock(_engine, (const float*)inputBuffer, (float*)outputBuffer, framesPerBuffer);
 	return 0;
 }
 
-static Effects* effects;
-static Sensor* sensor1;
-static Sensor* sensor2;
-static Sensor* sensor3;
+static void setChunkSize(void* _engine, int chunkSize) {
+	Engine_setChunkSize((Engine*)_engine, chunkSize);
+}
 
-static void setup() {
+static Engine* engine;
+static Controls* controls[MAX_CHAINS];
+
+static Controls* Controls_create(const int* pins) {
+	Controls* ctl = (Controls*)malloc(sizeof(Controls));
+	ctl->sensor1 = Sensor_create(pins[0], pins[1], 5, 65, 3);
+	ctl->sensor2 = Sensor_create(pins[2], pins[3], 5, 50, 3);
+	ctl->sensor3 = Sensor_create(pins[4], pins[5], 5, 45, 3);
+	ctl->loopGesture = Gesture_create(LOOP_GESTURE_DIST);
+	ctl->lastDist1 = 0;
+	ctl->lastDist2 = 0;
+	ctl->lastDist3 = 0;
+	ctl->lastZone = -1;
+	ctl->halfSpeed = false;
+	return ctl;
+}
+
+static void Controls_destroy(Controls* ctl) {
+	Sensor_destroy(ctl->sensor1);
+	Sensor_destroy(ctl->sensor2);
+	Sensor_destroy(ctl->sensor3);
+	Gesture_destroy(ctl->loopGesture);
+	free(ctl);
+}
+
+// one performer's effects, the same for every chain apart from the loop file
+static Effects* buildChain(int index) {
 	Gain* gain = Gain_create(GAIN_MAX);
 	Distortion* dist = Distortion_create(DISTORT_MIN);
-	Delay* del = Delay_create(0, 0.5f, SAMPLE_RATE, CHUNK_SIZE);
+	Delay* del = Delay_create(0, 0.5f, SAMPLE_RATE, tuning.chunkSize);
+	// follows the hand continuously rather than crossfading once per chunk
+	Delay_setGlide(del, true);
 	//~ int shiftAmounts[VOICES] = {-12, -7, 4, 7, 9, 14, 16, 19, 24};
 	//~ float mixAmounts[VOICES] = {0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8};
 	//~ Harmonizer* harm = Harmonizer_create(VOICES, shiftAmounts, mixAmounts, SAMPLE_RATE);
@@ -82,11 +204,50 @@ static void setup() {
 	for (unsigned int i = 0; i < VOICES; ++i) {
 		Harmonizer_disableVoice(harm, i);
 	}
-	effects = Effects_create(gain, dist, del, harm);
+	Filter* filter = Filter_create(FILTER_SECTIONS, CUTOFF_MAX, SAMPLE_RATE);
+	Reverb* reverb = Reverb_create(DECAY_MIN, REVERB_DAMPING, REVERB_MIX, SAMPLE_RATE);
+	Chorus* chorus = Chorus_create(CHORUS_VOICES, 15, 3, 0.8f, 0.5f, SAMPLE_RATE);
+	Flanger* flanger = Flanger_create(1, 1, 0.25f, 0.6f, 0.5f, SAMPLE_RATE);
+	// neither is on a sensor yet, switch them on for sets that want them
+	chorus->active = false;
+	flanger->active = false;
+	Doppler* doppler = Doppler_create(DOPPLER_SOUND_SPEED, SAMPLE_RATE);
+	FreqShift* freqShift = FreqShift_create(FREQSHIFT_HZ, 1, SAMPLE_RATE);
+	// not on a sensor yet either
+	freqShift->active = false;
+	// runs without a looper if the loop file can't be made
+	char loopFile[64];
+	snprintf(loopFile, sizeof(loopFile), LOOP_FILE_CHAIN, index);
+	Looper* looper = Looper_create(index == 0 ? LOOP_FILE : loopFile, LOOP_SECONDS, LOOP_MIX, SAMPLE_RATE);
+	Limiter* limiter = Limiter_create(LIMITER_THRESHOLD, LIMITER_LOOKAHEAD, LIMITER_RELEASE, SAMPLE_RATE);
+	if (index == 0) {
+		printf("limiter adds %.2f ms of latency\n", Limiter_getLatency(limiter) * 1000.0f / SAMPLE_RATE);
+	}
+	Compressor* comp = Compressor_create(ENV_RMS, COMP_THRESHOLD, COMP_RATIO, COMP_ATTACK,
+										 COMP_RELEASE, COMP_MAKEUP, SAMPLE_RATE);
+	return Effects_create(gain, dist, del, harm, filter, reverb, chorus, flanger, doppler,
+						  freqShift, looper, limiter, comp);
+}
 
-	sensor1 = Sensor_create(5, 6, 5, 65, 3);
-	sensor2 = Sensor_create(17, 27, 5, 50, 3);
-	sensor3 = Sensor_create(23, 24, 5, 45, 3);
+static void setup() {
+	// before anything is allocated, so the looper can keep its file out of the lock
+	Realtime_lockMemory();
+	// the sensor loop's scaling and every effect read these tables
+	LutMath_init();
+	Distortion_initTables();
+	if (Tuning_load(&tuning, TUNING_FILE)) {
+		printf("using calibrated chunk size %d, latency %.2f ms\n",
+			   tuning.chunkSize, tuning.latency * 1000);
+	}
+	engine = Engine_create(inChannels, outChannels, MAX_CHUNK_SIZE, SAMPLE_RATE, tuning.chunkSize);
+	for (int c = 0; c < inChannels; ++c) {
+		Engine_addChain(engine, buildChain(c),
+						PitchTracker_create(PITCH_MIN_FREQ, PITCH_MAX_FREQ, SAMPLE_RATE));
+		controls[c] = c < SENSOR_SETS ? Controls_create(sensorPins[c]) : NULL;
+	}
+
+	realtime = Realtime_create(AUDIO_CORE, AUDIO_PRIORITY, SENSOR_CORE, SENSOR_PRIORITY,
+							   SAMPLE_RATE, tuning.chunkSize);
 
 	Pa_Initialize();
 
@@ -98,109 +259,357 @@ static void setup() {
 
 static void exitHandler() {
 	Pa_Terminate();
-	Sensor_destroy(sensor1);
-	Sensor_destroy(sensor2);
-	Effects_destroy(effects);
+	// the recording only gets its header once it's stopped
+	if (recorder != NULL) {
+		Recorder_destroy(recorder);
+	}
+	for (int c = 0; c < engine->numChains; ++c) {
+		if (controls[c] != NULL) {
+			Controls_destroy(controls[c]);
+		}
+	}
+	Engine_destroy(engine);
+	Realtime_destroy(realtime);
 }
 
-int main() {
-	// register teardown function to handle ctrl-c and such
-	atexit(exitHandler);
-	setup();
-	PaError err;
-	PaStream *stream;
-	err = Pa_OpenDefaultStream(&stream, IN_CHANNELS, OUT_CHANNELS,
-								 paFloat32, SAMPLE_RATE, CHUNK_SIZE,
-								 audioCallback, effects);
-	PaAlsa_EnableRealtimeScheduling(stream, 1);
-	err = Pa_StartStream(stream);
-	if (err != paNoError) goto error;
-	float distance1 = 0;
-	float distance2 = 0;
-	float distance3 = 0;
-	float lastDist1 = 0;
-	float lastDist2 = 0;
-	float lastDist3 = 0;
+// tap steps record -> play -> overdub -> play, double tap toggles half speed, hold stops
+static void controlLooper(Looper* lp, GestureType gesture, bool* halfSpeed) {
+	if (gesture == GESTURE_TAP) {
+		LoopState state = Looper_getState(lp);
+		if (state == LOOP_IDLE) {
+			Looper_record(lp);
+		}
+		else if (state == LOOP_PLAYING) {
+			Looper_overdub(lp);
+		}
+		else {
+			Looper_play(lp);
+		}
+	}
+	else if (gesture == GESTURE_DOUBLE_TAP) {
+		*halfSpeed = !*halfSpeed;
+		Looper_setHalfSpeed(lp, *halfSpeed);
+	}
+	else if (gesture == GESTURE_HOLD) {
+		Looper_stop(lp);
+	}
+}
+
+// runs every effect flat out so the sweep measures the worst case
+static int calibrate() {
+	for (int c = 0; c < engine->numChains; ++c) {
+		Effects* effects = engine->chains[c]->fx;
+		effects->harmonizer->active = true;
+		Harmonizer_setActiveVoices(effects->harmonizer, VOICES);
+		Delay_setTime(effects->delay, DELAYSAMPS_MAX / 2);
+		Delay_setFeedback(effects->delay, DELAYFDBK_MAX / 2);
+		Distortion_set(effects->distortion, DISTORT_MAX);
+	}
+	Tuning best;
+	if (!Tuner_run(&best, engine, setChunkSize, realtime, audioCallback,
+				   inChannels, outChannels, SAMPLE_RATE)) {
+		fprintf(stderr, "no stable setting found, keeping the current one\n");
+		return 1;
+	}
+	printf("best: chunk size %d, suggested latency %.2f ms\n",
+		   best.chunkSize, best.latency * 1000);
+	if (!Tuning_save(&best, TUNING_FILE)) {
+		fprintf(stderr, "could not write %s\n", TUNING_FILE);
+		return 1;
+	}
+	return 0;
+}
+
+// reads one performer's sensors and moves their chain's effects to match
+static void updateControls(Controls* ctl, Effects* effects) {
+	Sensor* sensor1 = ctl->sensor1;
+	Sensor* sensor2 = ctl->sensor2;
+	Sensor* sensor3 = ctl->sensor3;
 	int harmoZone = -1;
-	int lastZone = -1;
 	float zoneSize = (sensor1->maxActiveDist - sensor1->minDist) / VOICES;
-	while (1) {
-		distance1 = Sensor_getCM(sensor1);
-		if (distance1 != -1 && distance1 >= sensor1->minDist) {
-			distance1 = Sensor_getAvgValue(sensor1, distance1);
-			if (distance1 != lastDist1) {
-				lastDist1 = distance1;
-				if (distance1 >= sensor1->maxActiveDist) {
-					effects->harmonizer->active = false;
-				}
-				else {
-					effects->harmonizer->active = true;
-					for (unsigned int i = 0; i < VOICES; ++i) {
-						if (distance1 <= sensor1->minDist + zoneSize * (i+1)) {
-							harmoZone = VOICES - i - 1;
-							if (harmoZone != lastZone) {
-								// for a jump closer to sensor, add new voices
-								for (int j = lastZone + 1; j <= harmoZone; ++j) {
-									Harmonizer_enableVoice(effects->harmonizer, j);
-								}
-								// jump further, remove voices
-								for (int j = lastZone; j > harmoZone; --j) {
-									Harmonizer_disableVoice(effects->harmonizer, j);
-								}
-									
-								lastZone = harmoZone;
+	float distance1 = Sensor_getCM(sensor1);
+	if (distance1 != -1 && distance1 >= sensor1->minDist) {
+		distance1 = Sensor_getAvgValue(sensor1, distance1);
+		// the harmony hand bends pitch by how fast it moves
+		Doppler_setVelocity(effects->doppler, Sensor_getVelocity(sensor1, distance1));
+		if (distance1 != ctl->lastDist1) {
+			ctl->lastDist1 = distance1;
+			if (distance1 >= sensor1->maxActiveDist) {
+				effects->harmonizer->active = false;
+			}
+			else {
+				effects->harmonizer->active = true;
+				for (unsigned int i = 0; i < VOICES; ++i) {
+					if (distance1 <= sensor1->minDist + zoneSize * (i+1)) {
+						harmoZone = VOICES - i - 1;
+						if (harmoZone != ctl->lastZone) {
+							// for a jump closer to sensor, add new voices
+							for (int j = ctl->lastZone + 1; j <= harmoZone; ++j) {
+								Harmonizer_enableVoice(effects->harmonizer, j);
 							}
-							float mixGain = 1 - linearScale(distance1,
-														sensor1->minDist + zoneSize*i,
-														sensor1->minDist + zoneSize*(i+1),
-														0, 1);
-							Harmonizer_setVoiceGain(effects->harmonizer, harmoZone, mixGain);
-							break;
+							// jump further, remove voices
+							for (int j = ctl->lastZone; j > harmoZone; --j) {
+								Harmonizer_disableVoice(effects->harmonizer, j);
+							}
+								
+							ctl->lastZone = harmoZone;
 						}
+						float mixGain = 1 - linearScale(distance1,
+													sensor1->minDist + zoneSize*i,
+													sensor1->minDist + zoneSize*(i+1),
+													0, 1);
+						Harmonizer_setVoiceGain(effects->harmonizer, harmoZone, mixGain);
+						break;
 					}
 				}
 			}
 		}
-		distance2 = Sensor_getCM(sensor2);
-		if (distance2 != -1 && distance2 >= sensor2->minDist) {
-			distance2 = Sensor_getAvgValue(sensor2, distance2);
-			// lock out delay changes until current change is finished
-			if (distance2 != lastDist2 && !effects->delay->changingDelay) {
-				lastDist2 = distance2;
-				// if distance is near the end of its range, shut the delay off 
-				if (distance2 > sensor2->maxActiveDist) {
-					Delay_setTime(effects->delay, 0);
-					Delay_setFeedback(effects->delay, 0);
-				}
-				// otherwise, scale the distance to acquire new delay time and feedback values
-				else {
-					float newDelay = linearScale(distance2, sensor2->minDist, sensor2->maxDist,
-												 DELAYSAMPS_MIN, DELAYSAMPS_MAX);
-					float newFeedback = DELAYFDBK_MAX - linearScale(distance2,
-														sensor2->minDist, sensor2->maxActiveDist,
-														DELAYFDBK_MIN, DELAYFDBK_MAX);
-					Delay_setTime(effects->delay, newDelay);
-					Delay_setFeedback(effects->delay, newFeedback);
-				}				
+	}
+	else {
+		Sensor_resetVelocity(sensor1);
+		Doppler_setVelocity(effects->doppler, 0);
+	}
+	float distance2 = Sensor_getCM(sensor2);
+	if (distance2 != -1 && distance2 >= sensor2->minDist) {
+		distance2 = Sensor_getAvgValue(sensor2, distance2);
+		// lock out delay changes until a crossfade is finished, gliding never locks out
+		if (distance2 != ctl->lastDist2 && !effects->delay->changingDelay) {
+			ctl->lastDist2 = distance2;
+			// if distance is near the end of its range, shut the delay off 
+			if (distance2 > sensor2->maxActiveDist) {
+				Delay_setTime(effects->delay, 0);
+				Delay_setFeedback(effects->delay, 0);
+				Reverb_setDecay(effects->reverb, DECAY_MIN);
+			}
+			// otherwise, scale the distance to acquire new delay time and feedback values
+			else {
+				float newDelay = linearScale(distance2, sensor2->minDist, sensor2->maxDist,
+											 DELAYSAMPS_MIN, DELAYSAMPS_MAX);
+				float newFeedback = DELAYFDBK_MAX - linearScale(distance2,
+													sensor2->minDist, sensor2->maxActiveDist,
+													DELAYFDBK_MIN, DELAYFDBK_MAX);
+				Delay_setTime(effects->delay, newDelay);
+				Delay_setFeedback(effects->delay, newFeedback);
+				// the room grows along with the feedback as the hand comes in
+				float newDecay = DECAY_MAX - linearScale(distance2,
+											sensor2->minDist, sensor2->maxActiveDist,
+											0, DECAY_MAX - DECAY_MIN);
+				Reverb_setDecay(effects->reverb, newDecay);
+			}				
+		}
+	}
+	float distance3 = Sensor_getCM(sensor3);
+	if (effects->looper != NULL) {
+		// raw reading, the average would smear a quick tap out
+		controlLooper(effects->looper, Gesture_update(ctl->loopGesture, distance3), &ctl->halfSpeed);
+		// keep the pages ahead of the loop position locked in
+		Looper_page(effects->looper);
+	}
+	if (distance3 != -1 && distance3 >= sensor3->minDist) {
+		distance3 = Sensor_getAvgValue(sensor3, distance3);
+		if (distance3 != ctl->lastDist3) {
+			ctl->lastDist3 = distance3;
+			float newDistort = DISTORT_MAX - linearScale(distance3,
+														 sensor1->minDist, sensor1->maxDist,
+														 DISTORT_MIN, DISTORT_MAX);
+			Distortion_set(effects->distortion, newDistort);
+			// the closer the hand, the harsher the curve as well as the drive
+			float newShape = DISTORT_SHAPE_MAX - linearScale(distance3,
+										sensor3->minDist, sensor3->maxDist,
+										0, DISTORT_SHAPE_MAX - DISTORT_SHAPE_MIN);
+			Distortion_setShape(effects->distortion, newShape);
+			// darken as the distortion comes up so it doesn't get fizzy
+			float newCutoff = logScale(distance3, sensor3->minDist, sensor3->maxDist,
+									   CUTOFF_MIN, CUTOFF_MAX);
+			Filter_setCutoff(effects->filter, newCutoff);
+		}
+	}
+}
+
+// set from the signal handler, ends the sensor loop so main can stop the audio
+// before exitHandler frees what the callback uses
+static volatile sig_atomic_t stopRequested = 0;
+
+static void signalHandler(int signal) {
+	stopRequested = 1;
+}
+
+int main(int argc, char** argv) {
+	bool calibrating = false;
+	const char* recordPath = NULL;
+	int recordFlags = RECORD_PREALLOCATE;
+	const char* alsaCapture = NULL;
+	const char* alsaPlayback = NULL;
+	int keyTonic = -1;
+	int keyScale = -1;
+	int harmWorkers = HARM_WORKERS;
+	float harmLatencyBudget = HARM_LATENCY_BUDGET;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--calibrate") == 0) {
+			calibrating = true;
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			recordPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--record-raw") == 0) {
+			recordFlags |= RECORD_RAW;
+		}
+		else if (strcmp(argv[i], "--record-direct") == 0) {
+			recordFlags |= RECORD_DIRECT;
+		}
+		else if (strcmp(argv[i], "--alsa") == 0 && i + 2 < argc) {
+			alsaCapture = argv[++i];
+			alsaPlayback = argv[++i];
+		}
+		// --key <tonic> <scale>, e.g. --key F# minor
+		else if (strcmp(argv[i], "--key") == 0 && i + 2 < argc) {
+			keyTonic = parseNoteName(argv[++i]);
+			keyScale = parseScaleName(argv[++i]);
+			if (keyTonic < 0 || keyScale < 0) {
+				fprintf(stderr, "unknown key %s %s, scales are major, minor, harmonic, "
+						"dorian and mixolydian\n", argv[i - 1], argv[i]);
+				return 1;
+			}
+		}
+		// --channels <in> <out>, a chain for every input
+		else if (strcmp(argv[i], "--channels") == 0 && i + 2 < argc) {
+			inChannels = atoi(argv[++i]);
+			outChannels = atoi(argv[++i]);
+			if (inChannels < 1 || inChannels > MAX_CHAINS || outChannels < 1) {
+				fprintf(stderr, "need 1 to %d input channels and at least 1 output\n", MAX_CHAINS);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--harm-workers") == 0 && i + 1 < argc) {
+			harmWorkers = atoi(argv[++i]);
+		}
+		// --harm-latency <ms>, enough for a block pipelines the workers
+		else if (strcmp(argv[i], "--harm-latency") == 0 && i + 1 < argc) {
+			harmLatencyBudget = atof(argv[++i]) / 1000;
+		}
+	}
+#ifndef USE_ALSA_MMAP
+	if (alsaCapture != NULL) {
+		fprintf(stderr, "built without USE_ALSA_MMAP, ignoring --alsa %s %s\n",
+				alsaCapture, alsaPlayback);
+	}
+#endif
+	// register teardown function to handle ctrl-c and such
+	atexit(exitHandler);
+	setup();
+	// after setup, since gpioInitialise puts in handlers of its own
+	signal(SIGINT, signalHandler);
+	signal(SIGTERM, signalHandler);
+	if (keyTonic >= 0) {
+		int degrees[VOICES] = KEY_DEGREES;
+		for (int c = 0; c < engine->numChains; ++c) {
+			Harmonizer_setKey(engine->chains[c]->fx->harmonizer, keyTonic, keyScale, degrees);
+		}
+	}
+	if (recordPath != NULL) {
+		recorder = Recorder_create(recordPath, SAMPLE_RATE, recordFlags, RECORD_PREALLOC_SECONDS);
+		if (recorder == NULL || Recorder_start(recorder) != 0) {
+			fprintf(stderr, "could not start recording to %s\n", recordPath);
+			return 1;
+		}
+	}
+	// with several chains the cores go to the chains rather than to one chain's voices
+	if (harmWorkers > 0 && engine->numChains > 1) {
+		fprintf(stderr, "ignoring --harm-workers, the chains already share the cores\n");
+	}
+	else if (harmWorkers > 0) {
+		Harmonizer* harm = engine->chains[0]->fx->harmonizer;
+		// a chunk longer than a harmonizer block gains nothing from the pipeline but its latency
+		bool pipelined = tuning.chunkSize <= HARM_BLOCK &&
+						 harmLatencyBudget >= (float)tuning.chunkSize / SAMPLE_RATE;
+		if (Harmonizer_startWorkers(harm, harmWorkers, pipelined) == 0) {
+			const int harmCores[] = HARM_CORES;
+			int numCores = sizeof(harmCores) / sizeof(harmCores[0]);
+			for (int w = 0; w < harm->numWorkers; ++w) {
+				Realtime_pinThread(harm->workers[w], harmCores[w % numCores], HARM_PRIORITY);
 			}
+			printf("harmonizer voices on %d workers, %.2f ms behind the dry signal\n", harm->numWorkers,
+				   Harmonizer_getLatency(harm, tuning.chunkSize) * 1000.0f / SAMPLE_RATE);
+		}
+		else {
+			fprintf(stderr, "could not start harmonizer workers, running the voices in the callback\n");
 		}
-		distance3 = Sensor_getCM(sensor3);
-		if (distance3 != -1 && distance3 >= sensor3->minDist) {
-			distance3 = Sensor_getAvgValue(sensor3, distance3);
-			if (distance3 != lastDist3) {
-				lastDist3 = distance3;
-				float newDistort = DISTORT_MAX - linearScale(distance3,
-															 sensor1->minDist, sensor1->maxDist,
-															 DISTORT_MIN, DISTORT_MAX);
-				Distortion_set(effects->distortion, newDistort);
+	}
+	if (engine->numChains > 1) {
+		const int engineCores[] = ENGINE_CORES;
+		int numCores = sizeof(engineCores) / sizeof(engineCores[0]);
+		if (Engine_startWorkers(engine, numCores) == 0) {
+			for (int w = 0; w < engine->numWorkers; ++w) {
+				Realtime_pinThread(engine->workers[w], engineCores[w], ENGINE_PRIORITY);
 			}
+			printf("%d chains on %d cores\n", engine->numChains, engine->numWorkers + 1);
+		}
+		else {
+			fprintf(stderr, "could not start chain workers, running every chain in the callback\n");
+		}
+	}
+	// everything is allocated and locked by now, fault it all in before audio starts
+	Engine_prefault(engine);
+	// an analysis every few callbacks would spike the load, so it runs alongside instead
+	for (int c = 0; c < engine->numChains; ++c) {
+		PitchTracker* pitch = engine->chains[c]->pitch;
+		if (PitchTracker_start(pitch) == 0) {
+			Realtime_pinThread(pitch->thread, PITCH_CORE, PITCH_PRIORITY);
+		}
+	}
+	if (calibrating) {
+		return calibrate();
+	}
+	PaError err = paNoError;
+	PaStream *stream = NULL;
+#ifdef USE_ALSA_MMAP
+	// --alsa <capture pcm> <playback pcm> skips PortAudio entirely
+	AlsaBackend* alsa = NULL;
+	if (alsaCapture != NULL) {
+		alsa = AlsaBackend_create(alsaCapture, alsaPlayback, SAMPLE_RATE, tuning.chunkSize,
+								  inChannels, outChannels, processBlock, engine, realtime);
+		if (alsa == NULL || AlsaBackend_start(alsa) != 0) {
+			fprintf(stderr, "could not start the ALSA backend\n");
+			return 1;
+		}
+	}
+	else
+#endif
+	{
+		err = openAudioStream(&stream, inChannels, outChannels, SAMPLE_RATE,
+							  tuning.chunkSize, tuning.latency, audioCallback, engine);
+		if (err != paNoError) goto error;
+		err = Pa_StartStream(stream);
+		if (err != paNoError) goto error;
+	}
+	// keep the busy-polling sensor reads on their own core, below the audio thread
+	Realtime_pinSensorThread(realtime);
+	int loops = 0;
+	while (!stopRequested) {
+		for (int c = 0; c < engine->numChains; ++c) {
+			if (controls[c] != NULL) {
+				updateControls(controls[c], engine->chains[c]->fx);
+			}
+		}
+		if (++loops >= REPORT_LOOPS) {
+			Realtime_report(realtime);
+			Engine_report(engine);
+			loops = 0;
 		}
 		time_sleep(0.06);
 	}
 	
-	err = Pa_StopStream(stream);
-	err = Pa_CloseStream(stream);
-	if (err != paNoError) goto error;
+	// the audio has to be stopped before exitHandler tears the chains down
+#ifdef USE_ALSA_MMAP
+	if (alsa != NULL) {
+		AlsaBackend_destroy(alsa);
+	}
+#endif
+	if (stream != NULL) {
+		err = Pa_StopStream(stream);
+		err = Pa_CloseStream(stream);
+		if (err != paNoError) goto error;
+	}
 	
 	Pa_Terminate();
 	printf("Test finished.\n");
@@ -1,3 +1,97 @@
+// four floats processed together, maps onto NEON on the Pi and SSE on a desktop
+typedef float float4 __attribute__((vector_size(16)));
+typedef int int4 __attribute__((vector_size(16)));
+
+// for structs with vector members: malloc only promises 16 bytes (8 on 32 bit ARM),
+// and AVX builds store eight-lane vectors with instructions that need 32
+static void* vectorAlloc(size_t bytes) {
+	void* mem;
+	return posix_memalign(&mem, 32, bytes) == 0 ? mem : NULL;
+}
+
+// one pole smoothing coefficient that gets 63% of the way in the given time
+static inline float onePoleCoef(float seconds, int sampleRate) {
+	return 1 - lutExp(-1 / (seconds * sampleRate));
+}
+
+/*
+ * SAMPLE STORAGE
+ * What delay lines and loops keep their history in. Float by default; building
+ * with -DSTORE_INT16 or -DSTORE_FLOAT16 halves the memory and, more to the point
+ * on the Pi, the bandwidth every read and write costs. int16 keeps STORE_HEADROOM
+ * above full scale, since feedback and stacked voices go past 1, and has a fixed
+ * noise floor below that; float16 has no clipping but only 11 bits of mantissa,
+ * so its error follows the signal level. On 32 bit ARM float16 needs
+ * -mfp16-format=ieee (and -mfpu=neon-fp16 to convert in hardware).
+ * Single samples convert with toStored/fromStored, blocks four at a time.
+ */
+#define STORE_HEADROOM (4.0f)
+
+#if defined(STORE_INT16)
+typedef int16_t StoredSample;
+typedef short StoredVec __attribute__((vector_size(8)));
+#elif defined(STORE_FLOAT16)
+typedef _Float16 StoredSample;
+typedef _Float16 StoredVec __attribute__((vector_size(8)));
+#else
+typedef float StoredSample;
+typedef float StoredVec __attribute__((vector_size(16)));
+#endif
+
+static inline StoredSample toStored(float x) {
+#if defined(STORE_INT16)
+	// conversion truncates, so add half a step away from zero to round
+	x = x * (32767 / STORE_HEADROOM) + copysignf(0.5f, x);
+	return x > 32767 ? 32767 : (x < -32767 ? -32767 : (StoredSample)x);
+#else
+	return (StoredSample)x;
+#endif
+}
+
+static inline float fromStored(StoredSample x) {
+#if defined(STORE_INT16)
+	return x * (STORE_HEADROOM / 32767);
+#else
+	return (float)x;
+#endif
+}
+
+static inline StoredVec toStored4(float4 x) {
+#if defined(STORE_INT16)
+	const float4 limit = {32767, 32767, 32767, 32767};
+	const int4 sign = {INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN};
+	const float4 half = {0.5f, 0.5f, 0.5f, 0.5f};
+	x = x * (32767 / STORE_HEADROOM) + (float4)(((int4)x & sign) | (int4)half);
+	// no vector min/max in C, so pick lanes with the comparison masks
+	int4 over = x > limit;
+	int4 under = x < -limit;
+	x = (float4)(((int4)x & ~(over | under)) | ((int4)limit & over) | ((int4)-limit & under));
+#endif
+	return __builtin_convertvector(x, StoredVec);
+}
+
+static inline float4 fromStored4(StoredVec x) {
+	float4 y = __builtin_convertvector(x, float4);
+#if defined(STORE_INT16)
+	y *= STORE_HEADROOM / 32767;
+#endif
+	return y;
+}
+
+// converts a block into storage; neither side needs to be aligned
+static inline void storeSamples(StoredSample* out, const float* in, unsigned long count) {
+	unsigned long i = 0;
+	for (; i + 4 <= count; i += 4) {
+		float4 x;
+		memcpy(&x, in + i, sizeof(x));
+		StoredVec y = toStored4(x);
+		memcpy(out + i, &y, sizeof(y));
+	}
+	for (; i < count; ++i) {
+		out[i] = toStored(in[i]);
+	}
+}
+
 typedef struct {
 	float gain;
 	bool active;
@@ -26,36 +120,195 @@ void Gain_destroy(Gain* g) {
 	free(g);
 }
 
+/*
+ * EFFECT: DISTORTION
+ * A bank of waveshaping curves, each stored as an interpolated table, so every
+ * curve costs the same two lookups and a new tone is just a new table. The
+ * amount sets a drive into the curve and the output is scaled back so a full
+ * scale input still comes out at full scale. The shape morphs between
+ * neighbouring curves. Corners (the hard clip knee, the fold points) are
+ * rounded off when the tables are built, which keeps the highest harmonics
+ * down and with them most of the aliasing.
+ */
+#define SHAPE_TABLE_SIZE (4096)
+// the tables cover drive * sample in [-SHAPE_RANGE, SHAPE_RANGE]
+#define SHAPE_RANGE (16.0f)
+// half width of the smoothing window, in table points
+#define SHAPE_SMOOTHING (8)
+
+typedef enum {
+	DIST_SOFT,
+	DIST_TANH,
+	DIST_TUBE,
+	DIST_HARD,
+	DIST_FOLD,
+	DIST_CURVES
+}
+DistortionCurve;
+
+static float shapeTables[DIST_CURVES][SHAPE_TABLE_SIZE + 1];
+
 typedef struct {
-	float amount;
+	// set from the control thread, the audio thread picks them up in Distortion_update
+	_Atomic float amount;
+	_Atomic float shape;
+
+	// what the audio thread uses, worked out from the amount and shape it last saw
+	float appliedAmount;
+	float appliedShape;
+	float drive;
+	int curveA;
+	int curveB;
+	float gainA;
+	float gainB;
 	
 	bool active;
 }
 Distortion;
 
+static float shapeCurve(int curve, float x) {
+	if (curve == DIST_SOFT) {
+		return x / (1 + fabsf(x));
+	}
+	if (curve == DIST_TANH) {
+		return tanhf(x);
+	}
+	if (curve == DIST_TUBE) {
+		// the negative half saturates earlier and lower, which adds even harmonics
+		return x >= 0 ? tanhf(x) : 0.6f * tanhf(x / 0.6f);
+	}
+	if (curve == DIST_HARD) {
+		return x > 1 ? 1 : (x < -1 ? -1 : x);
+	}
+	// fold: a triangle through the origin, so anything past +/-1 folds back
+	float folded = fmodf(fabsf(x + 1), 4);
+	return folded < 2 ? folded - 1 : 3 - folded;
+}
+
+// builds the shape tables every distortion reads; call it once, next to LutMath_init,
+// before any thread that makes or runs a distortion starts
+void Distortion_initTables() {
+	float raw[SHAPE_TABLE_SIZE + 1 + 2 * SHAPE_SMOOTHING];
+	for (int curve = 0; curve < DIST_CURVES; ++curve) {
+		for (int i = 0; i < SHAPE_TABLE_SIZE + 1 + 2 * SHAPE_SMOOTHING; ++i) {
+			float x = SHAPE_RANGE * (2.0f * (i - SHAPE_SMOOTHING) / SHAPE_TABLE_SIZE - 1);
+			raw[i] = shapeCurve(curve, x);
+		}
+		// a short Hann window average rounds the corners
+		for (int i = 0; i <= SHAPE_TABLE_SIZE; ++i) {
+			float sum = 0;
+			float weights = 0;
+			for (int j = -SHAPE_SMOOTHING; j <= SHAPE_SMOOTHING; ++j) {
+				float weight = 1 + cosf(M_PI * j / (SHAPE_SMOOTHING + 1));
+				sum += raw[i + SHAPE_SMOOTHING + j] * weight;
+				weights += weight;
+			}
+			shapeTables[curve][i] = sum / weights;
+		}
+	}
+}
+
+static inline float shapeLookup(int curve, float x) {
+	float position = (x + SHAPE_RANGE) * (SHAPE_TABLE_SIZE / (2 * SHAPE_RANGE));
+	if (position <= 0) {
+		return shapeTables[curve][0];
+	}
+	if (position >= SHAPE_TABLE_SIZE) {
+		return shapeTables[curve][SHAPE_TABLE_SIZE];
+	}
+	int index = (int)position;
+	const float* table = shapeTables[curve];
+	return table[index] + (table[index + 1] - table[index]) * (position - index);
+}
+
+// the gain that brings the loudest point a full scale input can reach back to 1
+static float Distortion_makeup(Distortion* dist, int curve) {
+	float peak = 0;
+	for (int i = 1; i <= 64; ++i) {
+		float value = fabsf(shapeLookup(curve, dist->drive * i / 64));
+		if (value > peak) {
+			peak = value;
+		}
+	}
+	return peak > 0 ? 1 / peak : 1;
+}
+
+static void Distortion_derive(Distortion* dist, float amount, float shape) {
+	// the old curve's (1 + k) x / (1 + k |x|) is the soft curve driven by k
+	float k = 2 * amount / (1 - amount);
+	dist->drive = k > 0.001f ? k : 0.001f;
+	int curveA = (int)shape;
+	int curveB = curveA + 1 < DIST_CURVES ? curveA + 1 : curveA;
+	float blend = shape - curveA;
+	dist->gainA = Distortion_makeup(dist, curveA) * (1 - blend);
+	dist->gainB = Distortion_makeup(dist, curveB) * blend;
+	dist->curveA = curveA;
+	dist->curveB = curveB;
+	dist->appliedAmount = amount;
+	dist->appliedShape = shape;
+}
+
+// on the audio thread, at the start of a block: works the curve out again if
+// the amount or shape changed since the last one
+void Distortion_update(Distortion* dist) {
+	float amount = atomic_load_explicit(&dist->amount, memory_order_relaxed);
+	float shape = atomic_load_explicit(&dist->shape, memory_order_relaxed);
+	if (amount != dist->appliedAmount || shape != dist->appliedShape) {
+		Distortion_derive(dist, amount, shape);
+	}
+}
+
 Distortion* Distortion_create(float _amount) {
 	Distortion* dist = (Distortion*)malloc(sizeof(Distortion));
-	dist->amount = _amount;
+	atomic_init(&dist->amount, _amount);
+	atomic_init(&dist->shape, (float)DIST_SOFT);
+	Distortion_derive(dist, _amount, DIST_SOFT);
 	dist->active = true;
 	return dist;
 }
 
+// amount in [0, 1), higher drives the curve harder
 void Distortion_set(Distortion* dist, float newAmount) {
-	dist->amount = newAmount;
+	atomic_store_explicit(&dist->amount, newAmount < 0.99f ? newAmount : 0.99f, memory_order_relaxed);
 }
 float Distortion_get(Distortion* dist) {
-	return dist->amount;
+	return atomic_load_explicit(&dist->amount, memory_order_relaxed);
+}
+
+// anywhere from 0 to DIST_CURVES - 1, in between morphs between neighbouring curves
+void Distortion_setShape(Distortion* dist, float newShape) {
+	float last = DIST_CURVES - 1;
+	atomic_store_explicit(&dist->shape, newShape < 0 ? 0 : (newShape > last ? last : newShape),
+						  memory_order_relaxed);
 }
 
 float Distortion_apply(Distortion* d, float sample) {
-	float k = 2 * d->amount / (1 - d->amount);
-	return (1 + k) * sample / (1 + k * abs(sample));
+	float x = sample * d->drive;
+	return shapeLookup(d->curveA, x) * d->gainA + shapeLookup(d->curveB, x) * d->gainB;
 }
 
 void Distortion_destroy(Distortion* dist) {
 	free(dist);
 }
 
+// how long a glide takes to get most (63%) of the way to a new delay time
+#define DELAY_GLIDE_SECONDS (0.08f)
+// fastest the read point may move, in samples per sample; 0.5 keeps the bend within
+// an octave down and a fifth up
+#define DELAY_GLIDE_MAX_SLEW (0.5f)
+// extra read points on the delay's buffer, for rhythmic patterns without extra delays
+#define DELAY_MAX_TAPS (8)
+
+typedef struct {
+	int delaySamps;
+	float gain;
+	float pan;
+	// constant power pan gains, worked out when the tap is set
+	float leftGain;
+	float rightGain;
+}
+DelayTap;
+
 typedef struct {
 	int delaySamps;
 	float feedback;
@@ -63,14 +316,22 @@ typedef struct {
 	int chunkSize;
 
 	int buffSize;
-	float* buffer;
-	float* readPtr;
-	float* writePtr;
+	StoredSample* buffer;
+	StoredSample* readPtr;
+	StoredSample* writePtr;
 
 	int newDelaySamps;
 	bool changingDelay;
 	float crossfadeFactor;
 
+	// tape style: the read point slides towards newDelaySamps instead of crossfading
+	bool glide;
+	float glideDelay;
+	float glideCoef;
+
+	int numTaps;
+	DelayTap taps[DELAY_MAX_TAPS];
+
 	bool active;
 }
 Delay;
@@ -83,7 +344,7 @@ Delay* Delay_create(int _delaySamps, float _feedback, int _sampleRate, int _chun
 	del->chunkSize = _chunkSize;
 
 	del->buffSize = del->sampleRate * 4;
-	del->buffer = (float*)malloc(sizeof(float) * del->buffSize);
+	del->buffer = (StoredSample*)malloc(sizeof(StoredSample) * del->buffSize);
 	// initialize circular buffer with zeros
 	for (unsigned int i = 0; i < del->buffSize; ++i) {
 		del->buffer[i] = 0;
@@ -94,6 +355,10 @@ Delay* Delay_create(int _delaySamps, float _feedback, int _sampleRate, int _chun
 	del->newDelaySamps = del->delaySamps;
 	del->changingDelay = false;
 	del->crossfadeFactor = 0;
+	del->glide = false;
+	del->glideDelay = del->delaySamps;
+	del->glideCoef = 1 - exp(-1 / (DELAY_GLIDE_SECONDS * del->sampleRate));
+	del->numTaps = 0;
 	del->active = true;
 
 	return del;
@@ -101,16 +366,108 @@ Delay* Delay_create(int _delaySamps, float _feedback, int _sampleRate, int _chun
 
 void Delay_setTime(Delay* del, int _delaySamps) {
 	del->newDelaySamps = _delaySamps;
-	del->changingDelay = true;
+	// gliding takes any number of changes, there's nothing to wait for
+	if (!del->glide) {
+		del->changingDelay = true;
+	}
+}
+
+// switches between crossfading to a new time (the default) and gliding to it
+void Delay_setGlide(Delay* del, bool _glide) {
+	del->glideDelay = del->delaySamps;
+	del->glide = _glide;
+}
+
+// crossfades take one chunk, so they need to know when the chunk size changes
+void Delay_setChunkSize(Delay* del, int _chunkSize) {
+	del->chunkSize = _chunkSize;
 }
 
 void Delay_setFeedback(Delay* del, float _feedback) {
 	del->feedback = _feedback;
 }
 
+// pan from -1 (left) to 1 (right). any time down to 0 is exact, even under a block:
+// the taps read back the block Delay_apply has just written
+void Delay_setTap(Delay* del, int tap, int _delaySamps, float _gain, float _pan) {
+	if (tap < 0 || tap >= DELAY_MAX_TAPS) {
+		return;
+	}
+	// a block is read back after it's written, so the whole block has to still be there
+	int longest = del->buffSize - del->chunkSize;
+	DelayTap* t = &del->taps[tap];
+	t->delaySamps = _delaySamps < 0 ? 0 : (_delaySamps > longest ? longest : _delaySamps);
+	t->gain = _gain;
+	t->pan = _pan;
+	float angle = (_pan + 1) * (float)M_PI / 4;
+	t->leftGain = _gain * cosf(angle);
+	t->rightGain = _gain * sinf(angle);
+	if (tap >= del->numTaps) {
+		del->numTaps = tap + 1;
+	}
+}
+
+// adds a tap after the last one, returns its index or -1 if they're all used
+int Delay_addTap(Delay* del, int _delaySamps, float _gain, float _pan) {
+	if (del->numTaps >= DELAY_MAX_TAPS) {
+		return -1;
+	}
+	Delay_setTap(del, del->numTaps, _delaySamps, _gain, _pan);
+	return del->numTaps - 1;
+}
+
+void Delay_clearTaps(Delay* del) {
+	del->numTaps = 0;
+}
+
+// the read point eases towards the target, so a change bends the pitch like a tape
+// machine's moving head instead of stepping, and reads between samples on the way
+static float Delay_applyGlide(Delay* del, float sample) {
+	float step = (del->newDelaySamps - del->glideDelay) * del->glideCoef;
+	// a big jump would otherwise bend the echo by octaves
+	if (step > DELAY_GLIDE_MAX_SLEW) {
+		step = DELAY_GLIDE_MAX_SLEW;
+	}
+	else if (step < -DELAY_GLIDE_MAX_SLEW) {
+		step = -DELAY_GLIDE_MAX_SLEW;
+	}
+	del->glideDelay += step;
+	del->delaySamps = (int)del->glideDelay;
+	// less than a sample back would be reading what's about to be overwritten
+	if (del->glideDelay >= 1) {
+		float position = (del->writePtr - del->buffer) - del->glideDelay;
+		if (position < 0) {
+			position += del->buffSize;
+		}
+		int index = (int)position;
+		int next = index + 1 < del->buffSize ? index + 1 : 0;
+		float frac = position - index;
+		float y0 = fromStored(del->buffer[index]);
+		float past = y0 + (fromStored(del->buffer[next]) - y0) * frac;
+		// fade the echo in over the first sample so arriving from 0 doesn't click
+		float fade = del->glideDelay < 2 ? del->glideDelay - 1 : 1;
+		sample += del->feedback * past * fade;
+	}
+	*del->writePtr++ = toStored(sample);
+	if (del->writePtr >= del->buffer + del->buffSize) {
+		del->writePtr -= del->buffSize;
+	}
+	return sample;
+}
+
 float Delay_apply(Delay* del, float sample) {
+	if (del->glide) {
+		return Delay_applyGlide(del, sample);
+	}
 	// newDelaySamps will be the same as delaySamps unless delay is changing
 	if (del->newDelaySamps == 0 && !del->changingDelay) {
+		// the taps still need the history even with no main echo
+		if (del->numTaps > 0) {
+			*del->writePtr++ = toStored(sample);
+			if (del->writePtr >= del->buffer + del->buffSize) {
+				del->writePtr -= del->buffSize;
+			}
+		}
 		return sample;
 	}
 	// calculate read pointer position, bounds check
@@ -121,13 +478,13 @@ float Delay_apply(Delay* del, float sample) {
 	// if we need to crossfade between old and new delay times
 	if (del->changingDelay) {
 		// calculate new read pointer position, bounds check
-		float* newReadPtr = del->writePtr - del->newDelaySamps;
+		StoredSample* newReadPtr = del->writePtr - del->newDelaySamps;
 		if (newReadPtr < del->buffer) {
 			newReadPtr += del->buffSize;
 		}
 		// need past data from two different points, crossfade between them
-		float oldData = sample + del->feedback * (*del->readPtr);
-		float newData = sample + del->feedback * (*newReadPtr);
+		float oldData = sample + del->feedback * fromStored(*del->readPtr);
+		float newData = sample + del->feedback * fromStored(*newReadPtr);
 		sample = newData * del->crossfadeFactor + oldData * (1 - del->crossfadeFactor);
 		// should complete the crossfade in one chunk
 		del->crossfadeFactor += 1.0f / del->chunkSize;
@@ -140,10 +497,10 @@ float Delay_apply(Delay* del, float sample) {
 	}
 	else {
 		// add past data from delay line
-		sample += del->feedback * (*del->readPtr);
+		sample += del->feedback * fromStored(*del->readPtr);
 	}
 	// write to delay line, increment write pointer
-	*del->writePtr++ = sample;
+	*del->writePtr++ = toStored(sample);
 	// bounds check
 	if (del->writePtr >= del->buffer + del->buffSize) {
 		del->writePtr -= del->buffSize;
@@ -152,6 +509,53 @@ float Delay_apply(Delay* del, float sample) {
 	return sample;
 }
 
+// out += in * gain, converting four at a time; in and out needn't be aligned
+static inline void mixScaled(float* out, const StoredSample* in, float gain, unsigned long count) {
+	float4 gains = {gain, gain, gain, gain};
+	unsigned long i = 0;
+	for (; i + 4 <= count; i += 4) {
+		StoredVec x;
+		float4 y;
+		memcpy(&x, in + i, sizeof(x));
+		memcpy(&y, out + i, sizeof(y));
+		y += fromStored4(x) * gains;
+		memcpy(out + i, &y, sizeof(y));
+	}
+	for (; i < count; ++i) {
+		out[i] += fromStored(in[i]) * gain;
+	}
+}
+
+// adds every tap's echo of the block that Delay_apply just wrote. Each tap's
+// block is one contiguous run of the buffer, or two where it wraps, so there
+// are no per-sample wrap checks. With right as NULL the taps are summed to
+// mono in buffer, otherwise they're panned between buffer (left) and right.
+void Delay_processTaps(Delay* del, float* buffer, float* right, unsigned long frames) {
+	int blockStart = (del->writePtr - del->buffer) - (int)frames;
+	for (int t = 0; t < del->numTaps; ++t) {
+		DelayTap* tap = &del->taps[t];
+		int start = blockStart - tap->delaySamps;
+		while (start < 0) {
+			start += del->buffSize;
+		}
+		unsigned long first = del->buffSize - start;
+		if (first > frames) {
+			first = frames;
+		}
+		const StoredSample* run = del->buffer + start;
+		if (right == NULL) {
+			mixScaled(buffer, run, tap->gain, first);
+			mixScaled(buffer + first, del->buffer, tap->gain, frames - first);
+		}
+		else {
+			mixScaled(buffer, run, tap->leftGain, first);
+			mixScaled(buffer + first, del->buffer, tap->leftGain, frames - first);
+			mixScaled(right, run, tap->rightGain, first);
+			mixScaled(right + first, del->buffer, tap->rightGain, frames - first);
+		}
+	}
+}
+
 void Delay_destroy(Delay* del) {
 	free(del->buffer);
 	free(del);
@@ -169,9 +573,9 @@ typedef struct {
 	int sampleRate;
 
 	int buffSize;
-	float* buffer;
-	float* readPtr;
-	float* writePtr;
+	StoredSample* buffer;
+	StoredSample* readPtr;
+	StoredSample* writePtr;
 
 	float crossfadeFactor;
 	bool fading;
@@ -187,7 +591,7 @@ FracDelay* FracDelay_create(float _delaySamps, int _sampleRate) {
 	del->sampleRate = _sampleRate;
 	del->buffSize = del->sampleRate * 2;
 
-	del->buffer = (float*)malloc(sizeof(float) * del->buffSize);
+	del->buffer = (StoredSample*)malloc(sizeof(StoredSample) * del->buffSize);
 	for (unsigned int i = 0; i < del->buffSize; ++i) {
 		del->buffer[i] = 0;
 	}
@@ -202,35 +606,42 @@ void FracDelay_setTime(FracDelay* del, float _delaySamps) {
 	del->delaySamps = _delaySamps;
 }
 
-float FracDelay_apply(FracDelay* del, float sample) {
-	if (del->delaySamps == 0) {
-		return sample;
-	}
+// writes one sample without reading anything back
+void FracDelay_write(FracDelay* del, float sample) {
 	// write to delay line, increment write pointer
-	*del->writePtr++ = sample;
+	*del->writePtr++ = toStored(sample);
 	// bounds check
 	if (del->writePtr >= del->buffer + del->buffSize) {
 		del->writePtr -= del->buffSize;
 	}
+}
+
+// reads at any delay time behind the last write, so one line can feed several taps
+float FracDelay_read(FracDelay* del, float delaySamps) {
 	// split delay time into integer and fractional parts
-	int intDelay = (int)floor(del->delaySamps);
-	float fracDelay = del->delaySamps - intDelay;
+	int intDelay = (int)floor(delaySamps);
+	float fracDelay = delaySamps - intDelay;
 	// calculate read pointer position, bounds check
-	del->readPtr = del->writePtr - intDelay;
-	if (del->readPtr < del->buffer) {
-		del->readPtr += del->buffSize;
+	StoredSample* readPtr = del->writePtr - intDelay;
+	if (readPtr < del->buffer) {
+		readPtr += del->buffSize;
 	}
 	// interpolate between two samples nearest to our fractional delay time
-	float* y0 = del->readPtr - 1;
-	float* y1 = del->readPtr;
+	StoredSample* y0 = readPtr - 1;
+	StoredSample* y1 = readPtr;
 	if (y0 < del->buffer) {
 		y0 += del->buffSize;
 	}
+	float x1 = fromStored(*y1);
+	return (fromStored(*y0) - x1) * fracDelay + x1;
+}
 
-	// add past data from delay line
-	sample = (*y0 - *y1) * fracDelay + *y1;
-	
-	return sample;
+float FracDelay_apply(FracDelay* del, float sample) {
+	if (del->delaySamps == 0) {
+		return sample;
+	}
+	FracDelay_write(del, sample);
+	return FracDelay_read(del, del->delaySamps);
 }
 
 void FracDelay_destroy(FracDelay* del) {
@@ -238,11 +649,20 @@ void FracDelay_destroy(FracDelay* del) {
 	free(del);
 }
 
+// samples a crossfade between the two delay lines takes
+#define PSHIFT_FADE_SAMPLES (1000)
+// default time for a retune to glide most of the way to its new pitch
+#define PSHIFT_GLIDE_SECONDS (0.02f)
+
 typedef struct {
 	float semitones;
 	int sampleRate;
 
 	float shiftFactor;
+	// where a retune is gliding shiftFactor to, and how fast
+	float targetShiftFactor;
+	float glideCoef;
+	bool gliding;
 	float maxDelay;
 	FracDelay* delay1;
 	FracDelay* delay2;
@@ -260,17 +680,23 @@ typedef struct {
 	bool globalFadeDown;
 	float effectGain;
 	float newEffectGain;
+	// a voice made with no shift passes the input straight through
+	bool bypass;
 	bool active;
 }
 PShift;
 
 PShift* PShift_create(float _semitones, float _sampleRate) {
+	LutMath_init();
 	PShift* pshift = (PShift*)malloc(sizeof(PShift));
 	pshift->semitones = _semitones;
 	pshift->sampleRate = _sampleRate;
 	
 	// controls the speed of the sawtooth delay time ramp, and therefore output pitch
-	pshift->shiftFactor = pow(2, pshift->semitones / 12) - 1;
+	pshift->shiftFactor = semitoneRatio(pshift->semitones) - 1;
+	pshift->targetShiftFactor = pshift->shiftFactor;
+	pshift->glideCoef = onePoleCoef(PSHIFT_GLIDE_SECONDS, pshift->sampleRate);
+	pshift->gliding = false;
 	// delay will modulate between 0-100 ms
 	pshift->maxDelay = pshift->sampleRate / 10;
 	// create two delay lines, 180 degrees out of phase with each other
@@ -286,13 +712,14 @@ PShift* PShift_create(float _semitones, float _sampleRate) {
 	pshift->fadingUp2 = false;
 	// help detect when to start crossfading
 	pshift->tolerance = fabs(pshift->shiftFactor / 2);
-	pshift->fadeOffset = pshift->shiftFactor * 1000;
+	pshift->fadeOffset = pshift->shiftFactor * PSHIFT_FADE_SAMPLES;
 
 	// vars to handle ramping an entire PShift voice's gain 
 	pshift->globalFadeUp = false;
 	pshift->globalFadeDown = false;
 	pshift->effectGain = 1;
 	pshift->newEffectGain = 1;
+	pshift->bypass = pshift->semitones == 0;
 	pshift->active = true;
 	return pshift;
 }
@@ -311,14 +738,43 @@ void PShift_setGain(PShift* pshift, float newGain) {
 	pshift->newEffectGain = newGain;
 }
 
-void PShift_set(PShift* pshift, float _shiftFactor) {
+// how long a retune takes to get most of the way there, 0 jumps straight to it
+void PShift_setGlide(PShift* pshift, float seconds) {
+	pshift->glideCoef = seconds > 0 ? onePoleCoef(seconds, pshift->sampleRate) : 1;
+}
+
+// the crossfade triggers depend on the ramp speed, so they move with it
+static inline void PShift_setRamp(PShift* pshift, float _shiftFactor) {
 	pshift->shiftFactor = _shiftFactor;
+	pshift->tolerance = fabsf(pshift->shiftFactor * 0.5f);
+	pshift->fadeOffset = pshift->shiftFactor * PSHIFT_FADE_SAMPLES;
+}
+
+// retunes a running voice to semitoneRatio(semitones) - 1, gliding there without
+// touching its delay lines. Safe on the audio thread, and cheap if the caller
+// keeps a table of factors rather than working each one out
+void PShift_set(PShift* pshift, float _shiftFactor) {
+	pshift->targetShiftFactor = _shiftFactor;
+	pshift->semitones = 12 * lutLog2(_shiftFactor + 1);
+	pshift->gliding = true;
+	// from here on a unison voice stays on its delay lines, jumping to dry would click
+	pshift->bypass = false;
 }
 
 float PShift_apply(PShift* pshift, float sample) {
-	if (pshift->semitones == 0) {
+	if (pshift->bypass) {
 		return sample;
 	}
+	if (pshift->gliding) {
+		float remaining = pshift->targetShiftFactor - pshift->shiftFactor;
+		if (fabsf(remaining) < 1e-6f) {
+			PShift_setRamp(pshift, pshift->targetShiftFactor);
+			pshift->gliding = false;
+		}
+		else {
+			PShift_setRamp(pshift, pshift->shiftFactor + remaining * pshift->glideCoef);
+		}
+	}
 	// apply current delays
 	float sample1 = FracDelay_apply(pshift->delay1, sample);
 	float sample2 = FracDelay_apply(pshift->delay2, sample);
@@ -345,28 +801,28 @@ float PShift_apply(PShift* pshift, float sample) {
 	FracDelay_setTime(pshift->delay2, newTime2);
 	// apply crossfading between delay lines if necessary
 	if (pshift->fadingDown1) {
-		pshift->fade1 -= 0.001;
+		pshift->fade1 -= 1.0f / PSHIFT_FADE_SAMPLES;
 		if (pshift->fade1 <= 0) {
 			pshift->fade1 = 0;
 			pshift->fadingDown1 = false;
 		}
 	}
 	else if (pshift->fadingUp1) {
-		pshift->fade1 += 0.001;
+		pshift->fade1 += 1.0f / PSHIFT_FADE_SAMPLES;
 		if (pshift->fade1 >= 1) {
 			pshift->fade1 = 1;
 			pshift->fadingUp1 = false;
 		}
 	}
 	if (pshift->fadingDown2) {
-		pshift->fade2 -= 0.001;
+		pshift->fade2 -= 1.0f / PSHIFT_FADE_SAMPLES;
 		if (pshift->fade2 <= 0) {
 			pshift->fade2 = 0;
 			pshift->fadingDown2 = false;
 		}
 	}
 	else if (pshift->fadingUp2) {
-		pshift->fade2 += 0.001;
+		pshift->fade2 += 1.0f / PSHIFT_FADE_SAMPLES;
 		if (pshift->fade2 >= 1) {
 			pshift->fade2 = 1;
 			pshift->fadingUp2 = false;
@@ -400,6 +856,44 @@ void PShift_destroy(PShift* pshift) {
 	free(pshift);
 }
 
+/*
+ * EFFECT: HARMONIZER
+ * Mixes pitch shifted copies of the input in with it. By default each voice
+ * is a fixed number of semitones above the input. In key mode each voice is a
+ * number of scale degrees above the note being played instead, so a third
+ * stays major or minor as the key needs. The played note comes from whoever
+ * calls Harmonizer_setInputPitch, normally with the pitch tracker's output.
+ * The voices retune only when the note changes, from a table of shift factors,
+ * so following a melody costs no pow and no buffer resets. A bend moves every
+ * voice by the same fraction of a semitone on top, and every retune glides.
+ */
+// the widest shift key mode will ask a voice for, in semitones either way
+#define HARM_MAX_SHIFT (24)
+// how far past the halfway point between notes the input has to go to change note
+#define HARM_NOTE_HYSTERESIS (0.2f)
+// voices run over blocks of at most this many samples, the workers' buffer size
+#define HARM_BLOCK (256)
+#define HARM_MAX_GROUPS (64)
+
+typedef enum {
+	SCALE_MAJOR,
+	SCALE_MINOR,
+	SCALE_HARMONIC_MINOR,
+	SCALE_DORIAN,
+	SCALE_MIXOLYDIAN,
+	NUM_SCALES
+}
+Scale;
+
+// semitones above the tonic of each degree
+static const int scaleSteps[NUM_SCALES][7] = {
+	{0, 2, 4, 5, 7, 9, 11},
+	{0, 2, 3, 5, 7, 8, 10},
+	{0, 2, 3, 5, 7, 8, 11},
+	{0, 2, 3, 5, 7, 9, 10},
+	{0, 2, 4, 5, 7, 9, 10},
+};
+
 typedef struct {
 	int numVoices;
 	int* shiftAmounts;
@@ -409,6 +903,44 @@ typedef struct {
 	PShift** shifters;
 	bool* activeVoices;
 
+	// key mode, where degrees replaces shiftAmounts
+	bool keyMode;
+	int keyTonic;
+	Scale keyScale;
+	int* degrees;
+	// MIDI note the voices are tuned around, -1 until one is heard
+	int note;
+	// each voice's interval in semitones before the bend
+	int* intervals;
+	float bend;
+	// semitoneRatio(s) - 1 for s from -HARM_MAX_SHIFT to HARM_MAX_SHIFT
+	float shiftFactors[2 * HARM_MAX_SHIFT + 1];
+	// the last input pitch asked for, applied where no worker is running
+	float inputPitch;
+	// the last bend asked for, from the control thread; the audio thread applies it
+	_Atomic float targetBend;
+	// the sum of the voices, before it goes back over the input
+	float* mix;
+
+	// voice groups and the threads that run them, see Harmonizer_startWorkers
+	int numWorkers;
+	pthread_t* workers;
+	struct HarmWorker* workerArgs;
+	int numGroups;
+	int* groupStarts;
+	float** groupOuts;
+	const float* blockIn;
+	unsigned long blockFrames;
+	// generation << 8 | the next group nobody has claimed yet
+	_Atomic uint32_t claim;
+	_Atomic int finished;
+	_Atomic bool running;
+	// pipelined, the workers run a block while the audio thread moves on to the next
+	bool pipelined;
+	float* pipeIn;
+	// frames in the block the workers are on, 0 when there isn't one
+	unsigned long pending;
+
 	bool active;
 }
 Harmonizer;
@@ -420,13 +952,40 @@ Harmonizer* Harmonizer_create(int _numVoices, int* _shiftAmounts, float* _mixAmo
 	harm->mixAmounts = (float*)malloc(sizeof(float) * harm->numVoices);
 	harm->shifters = (PShift**)malloc(sizeof(PShift*) * harm->numVoices);
 	harm->activeVoices = (bool*)malloc(sizeof(bool) * harm->numVoices);
+	harm->degrees = (int*)malloc(sizeof(int) * harm->numVoices);
+	harm->intervals = (int*)malloc(sizeof(int) * harm->numVoices);
 	harm->sampleRate = _sampleRate;
 	for (unsigned int i = 0; i < harm->numVoices; ++i) {
 		harm->shiftAmounts[i] = _shiftAmounts[i];
 		harm->mixAmounts[i] = _mixAmounts[i];
 		harm->shifters[i] = PShift_create(harm->shiftAmounts[i], harm->sampleRate);
 		harm->activeVoices[i] = true;
+		harm->degrees[i] = 0;
+		harm->intervals[i] = harm->shiftAmounts[i];
 	}
+	for (int s = -HARM_MAX_SHIFT; s <= HARM_MAX_SHIFT; ++s) {
+		harm->shiftFactors[s + HARM_MAX_SHIFT] = semitoneRatio(s) - 1;
+	}
+	harm->keyMode = false;
+	harm->keyTonic = 0;
+	harm->keyScale = SCALE_MAJOR;
+	harm->note = -1;
+	harm->bend = 0;
+	harm->inputPitch = 0;
+	atomic_init(&harm->targetBend, 0);
+	harm->mix = (float*)malloc(sizeof(float) * HARM_BLOCK);
+	harm->numWorkers = 0;
+	harm->workers = NULL;
+	harm->workerArgs = NULL;
+	harm->numGroups = 0;
+	harm->groupStarts = NULL;
+	harm->groupOuts = NULL;
+	atomic_init(&harm->claim, 0);
+	atomic_init(&harm->finished, 0);
+	atomic_init(&harm->running, false);
+	harm->pipelined = false;
+	harm->pipeIn = NULL;
+	harm->pending = 0;
 	harm->active = true;
 	return harm;
 }
@@ -437,6 +996,10 @@ void Harmonizer_addVoice(Harmonizer* harm, int shift, float mix) {
 	harm->mixAmounts = (float*)realloc(harm->mixAmounts, sizeof(float) * harm->numVoices);
 	harm->shifters = (PShift**)realloc(harm->shifters, sizeof(PShift*) * harm->numVoices);
 	harm->activeVoices = (bool*)realloc(harm->activeVoices, sizeof(bool) * harm->numVoices);
+	harm->degrees = (int*)realloc(harm->degrees, sizeof(int) * harm->numVoices);
+	harm->degrees[harm->numVoices - 1] = 0;
+	harm->intervals = (int*)realloc(harm->intervals, sizeof(int) * harm->numVoices);
+	harm->intervals[harm->numVoices - 1] = shift;
 	harm->shiftAmounts[harm->numVoices - 1] = shift;
 	harm->mixAmounts[harm->numVoices - 1] = mix;
 	harm->shifters[harm->numVoices - 1] = PShift_create(shift, harm->sampleRate);
@@ -470,19 +1033,357 @@ void Harmonizer_setVoiceGain(Harmonizer* harm, int voice, float gain) {
 	//~ harm->mixAmounts[voice] = gain;
 }
 
-float Harmonizer_apply(Harmonizer* harm, float sample) {
-	float harmSamp = sample;
+static void Harmonizer_retuneVoice(Harmonizer* harm, int voice, int semitones) {
+	if (semitones > HARM_MAX_SHIFT) {
+		semitones = HARM_MAX_SHIFT;
+	}
+	else if (semitones < -HARM_MAX_SHIFT) {
+		semitones = -HARM_MAX_SHIFT;
+	}
+	harm->intervals[voice] = semitones;
+	// off the table's whole semitones while bent, the lookup tables are still cheap
+	float shiftFactor = harm->bend == 0 ? harm->shiftFactors[semitones + HARM_MAX_SHIFT] :
+						semitoneRatio(semitones + harm->bend) - 1;
+	PShift_set(harm->shifters[voice], shiftFactor);
+}
+
+static void Harmonizer_followPitch(Harmonizer* harm);
+
+// retunes to the latest pitch and bend, on the audio thread while no worker is running a voice
+static void Harmonizer_update(Harmonizer* harm) {
+	float targetBend = atomic_load_explicit(&harm->targetBend, memory_order_relaxed);
+	if (targetBend != harm->bend) {
+		harm->bend = targetBend;
+		for (unsigned int i = 0; i < harm->numVoices; ++i) {
+			Harmonizer_retuneVoice(harm, i, harm->intervals[i]);
+		}
+	}
+	Harmonizer_followPitch(harm);
+}
+
+// moves every voice by the same amount on top of its interval, e.g. from a sensor.
+// safe from any thread, the voices retune at the start of the next block
+void Harmonizer_setBend(Harmonizer* harm, float semitones) {
+	atomic_store_explicit(&harm->targetBend, semitones, memory_order_relaxed);
+}
+
+// how long the voices take to slide to a new note or bend
+void Harmonizer_setGlide(Harmonizer* harm, float seconds) {
+	for (unsigned int i = 0; i < harm->numVoices; ++i) {
+		PShift_setGlide(harm->shifters[i], seconds);
+	}
+}
+
+// semitones from note up (or down) the given number of degrees of the key
+static int Harmonizer_interval(Harmonizer* harm, int note, int degrees) {
+	const int* steps = scaleSteps[harm->keyScale];
+	int pitchClass = ((note - harm->keyTonic) % 12 + 12) % 12;
+	// a note outside the key harmonizes like the scale note just below it
+	int degree = 6;
+	while (steps[degree] > pitchClass) {
+		--degree;
+	}
+	int target = degree + degrees;
+	int octaves = target >= 0 ? target / 7 : -((6 - target) / 7);
+	return steps[target - octaves * 7] + 12 * octaves - pitchClass;
+}
+
+// tonic is a pitch class, 0 for C; degrees are per voice, 2 is a third above.
+// only call before the stream starts, the audio thread reads all of these
+void Harmonizer_setKey(Harmonizer* harm, int tonic, Scale scale, const int* degrees) {
+	harm->keyTonic = ((tonic % 12) + 12) % 12;
+	harm->keyScale = scale;
+	for (unsigned int i = 0; i < harm->numVoices; ++i) {
+		harm->degrees[i] = degrees[i];
+	}
+	harm->keyMode = true;
+	// retune on the next pitch, whatever note it is
+	harm->note = -1;
+}
+
+// in key mode, retunes the voices around the last input pitch if its note changed
+static void Harmonizer_followPitch(Harmonizer* harm) {
+	float frequency = harm->inputPitch;
+	if (!harm->keyMode || frequency <= 0) {
+		return;
+	}
+	float note = 69 + 12 * lutLog2(frequency * (1.0f / 440));
+	if (harm->note >= 0 && fabsf(note - harm->note) < 0.5f + HARM_NOTE_HYSTERESIS) {
+		return;
+	}
+	harm->note = (int)floorf(note + 0.5f);
 	for (unsigned int i = 0; i < harm->numVoices; ++i) {
-		if (harm->activeVoices[i]) {
-			harmSamp += PShift_apply(harm->shifters[i], sample) * harm->mixAmounts[i];
+		Harmonizer_retuneVoice(harm, i, Harmonizer_interval(harm, harm->note, harm->degrees[i]));
+	}
+}
+
+// in Hz, 0 when there's no clear pitch, which keeps the last note's harmony.
+// only does anything in key mode, cheap enough to call every block
+void Harmonizer_setInputPitch(Harmonizer* harm, float frequency) {
+	harm->inputPitch = frequency;
+	if (!harm->pipelined) {
+		Harmonizer_followPitch(harm);
+	}
+}
+
+// sums one group's voices over the current block into its own buffer
+static void Harmonizer_runGroup(Harmonizer* harm, int group) {
+	const float* in = harm->blockIn;
+	float* out = harm->groupOuts[group];
+	unsigned long frames = harm->blockFrames;
+	memset(out, 0, sizeof(float) * frames);
+	for (int v = harm->groupStarts[group]; v < harm->groupStarts[group + 1]; ++v) {
+		if (!harm->activeVoices[v]) {
+			continue;
+		}
+		PShift* pshift = harm->shifters[v];
+		float mix = harm->mixAmounts[v];
+		for (unsigned long i = 0; i < frames; ++i) {
+			out[i] += PShift_apply(pshift, in[i]) * mix;
+		}
+	}
+}
+
+// claims and runs the generation's groups until none are left. the workers and
+// the audio thread all come through here, so a worker that's asleep or preempted
+// only means the audio thread does its groups too, never that it waits on one
+static void Harmonizer_work(Harmonizer* harm, uint32_t generation) {
+	uint32_t claim = atomic_load_explicit(&harm->claim, memory_order_acquire);
+	while ((claim >> 8) == generation && (int)(claim & 0xff) < harm->numGroups) {
+		if (atomic_compare_exchange_weak_explicit(&harm->claim, &claim, claim + 1,
+												  memory_order_acquire, memory_order_acquire)) {
+			Harmonizer_runGroup(harm, claim & 0xff);
+			atomic_fetch_add_explicit(&harm->finished, 1, memory_order_release);
+			claim = atomic_load_explicit(&harm->claim, memory_order_acquire);
+		}
+	}
+}
+
+typedef struct HarmWorker {
+	Harmonizer* harm;
+	// posted once a block, and to stop
+	sem_t wake;
+}
+HarmWorker;
+
+// hands a block to the workers, in has to stay put until the join
+static void Harmonizer_fork(Harmonizer* harm, const float* in, unsigned long frames) {
+	harm->blockIn = in;
+	harm->blockFrames = frames;
+	atomic_store_explicit(&harm->finished, 0, memory_order_relaxed);
+	uint32_t generation = ((atomic_load_explicit(&harm->claim, memory_order_relaxed) >> 8) + 1) & 0xffffff;
+	atomic_store_explicit(&harm->claim, generation << 8, memory_order_release);
+	// only a syscall for the workers that are actually asleep
+	for (int w = 0; w < harm->numWorkers; ++w) {
+		sem_post(&harm->workerArgs[w].wake);
+	}
+}
+
+static void Harmonizer_join(Harmonizer* harm) {
+	Harmonizer_work(harm, atomic_load_explicit(&harm->claim, memory_order_relaxed) >> 8);
+	while (atomic_load_explicit(&harm->finished, memory_order_acquire) < harm->numGroups) {
+	}
+}
+
+static void* Harmonizer_worker(void* _worker) {
+	HarmWorker* worker = (HarmWorker*)_worker;
+	Harmonizer* harm = worker->harm;
+	uint32_t seen = atomic_load(&harm->claim) >> 8;
+	while (true) {
+		// posts pile up if we fall behind, the generation tells us if there's anything new
+		sem_wait(&worker->wake);
+		if (!atomic_load_explicit(&harm->running, memory_order_relaxed)) {
+			break;
+		}
+		uint32_t generation = atomic_load_explicit(&harm->claim, memory_order_acquire) >> 8;
+		if (generation != seen) {
+			seen = generation;
+			Harmonizer_work(harm, generation);
+		}
+	}
+	return NULL;
+}
+
+// at most HARM_BLOCK frames
+static void Harmonizer_processBlock(Harmonizer* harm, float* buffer, unsigned long frames) {
+	// pipelined, the workers are still on the last block until the join
+	if (!harm->pipelined) {
+		Harmonizer_update(harm);
+	}
+	if (harm->numWorkers == 0) {
+		// a voice at a time, which keeps each one's delay lines in cache
+		float* mix = harm->mix;
+		memcpy(mix, buffer, sizeof(float) * frames);
+		for (unsigned int v = 0; v < harm->numVoices; ++v) {
+			if (!harm->activeVoices[v]) {
+				continue;
+			}
+			PShift* pshift = harm->shifters[v];
+			float mixAmount = harm->mixAmounts[v];
+			for (unsigned long i = 0; i < frames; ++i) {
+				mix[i] += PShift_apply(pshift, buffer[i]) * mixAmount;
+			}
 		}
+		memcpy(buffer, mix, sizeof(float) * frames);
+		return;
+	}
+	if (!harm->pipelined) {
+		Harmonizer_fork(harm, buffer, frames);
+		Harmonizer_join(harm);
+		for (int g = 0; g < harm->numGroups; ++g) {
+			const float* groupOut = harm->groupOuts[g];
+			for (unsigned long i = 0; i < frames; ++i) {
+				buffer[i] += groupOut[i];
+			}
+		}
+		return;
+	}
+	// pipelined: collect the block before this one, then start on this one
+	if (harm->pending > 0) {
+		Harmonizer_join(harm);
+	}
+	Harmonizer_update(harm);
+	memcpy(harm->pipeIn, buffer, sizeof(float) * frames);
+	// the delay is one block, so a block of a new size has nothing to line up with
+	if (harm->pending == frames) {
+		for (int g = 0; g < harm->numGroups; ++g) {
+			const float* groupOut = harm->groupOuts[g];
+			for (unsigned long i = 0; i < frames; ++i) {
+				buffer[i] += groupOut[i];
+			}
+		}
+	}
+	Harmonizer_fork(harm, harm->pipeIn, frames);
+	harm->pending = frames;
+}
+
+// adds the voices to the input in place. pipelined, only the last HARM_BLOCK of a
+// longer buffer overlaps the next call, the earlier ones are joined within this one
+void Harmonizer_process(Harmonizer* harm, float* buffer, unsigned long frames) {
+	for (unsigned long offset = 0; offset < frames; offset += HARM_BLOCK) {
+		unsigned long block = frames - offset < HARM_BLOCK ? frames - offset : HARM_BLOCK;
+		Harmonizer_processBlock(harm, buffer + offset, block);
+	}
+}
+
+// for while the harmonizer is switched off: waits out the block the workers are
+// on and forgets it, so switching back on doesn't mix in voices from before
+void Harmonizer_drop(Harmonizer* harm) {
+	if (harm->pending > 0) {
+		Harmonizer_join(harm);
+		harm->pending = 0;
+	}
+}
+
+void Harmonizer_stopWorkers(Harmonizer* harm);
+
+/*
+ * Spreads the voices over numWorkers threads, in contiguous groups. Without
+ * pipelining each block is a fork/join: the audio thread hands the block out,
+ * runs groups itself until none are left unclaimed and waits for the rest, so
+ * the voices cost it about a group's time instead of all of theirs. Pipelined,
+ * the workers get a whole block period: the audio thread mixes in the voices
+ * of the block before and hands the current one out without waiting, which
+ * puts the voices, not the dry signal, Harmonizer_getLatency samples behind.
+ * That only works for blocks of up to HARM_BLOCK: a longer one is processed in
+ * HARM_BLOCK pieces, and each piece's voices are due while the same call is
+ * still running, so the workers get no more time than with fork/join, just
+ * the latency. Pipeline only when the chunk size is at most HARM_BLOCK.
+ * Add every voice first, the groups are fixed here. The threads are plain
+ * ones, pin them through harm->workers. Returns 0, or -1 if they didn't start.
+ */
+int Harmonizer_startWorkers(Harmonizer* harm, int numWorkers, bool pipelined) {
+	if (harm->numWorkers > 0 || numWorkers < 1) {
+		return -1;
+	}
+	// the audio thread runs a group too, unless it's pipelined
+	int numGroups = pipelined ? numWorkers : numWorkers + 1;
+	if (numGroups > (int)harm->numVoices) {
+		numGroups = harm->numVoices;
+	}
+	if (numGroups > HARM_MAX_GROUPS) {
+		numGroups = HARM_MAX_GROUPS;
+	}
+	numWorkers = pipelined ? numGroups : numGroups - 1;
+	if (numWorkers < 1) {
+		return -1;
+	}
+	harm->numGroups = numGroups;
+	harm->groupStarts = (int*)malloc(sizeof(int) * (numGroups + 1));
+	harm->groupOuts = (float**)malloc(sizeof(float*) * numGroups);
+	for (int g = 0; g < numGroups; ++g) {
+		harm->groupStarts[g] = g * harm->numVoices / numGroups;
+		harm->groupOuts[g] = (float*)calloc(HARM_BLOCK, sizeof(float));
+	}
+	harm->groupStarts[numGroups] = harm->numVoices;
+	harm->pipeIn = (float*)calloc(HARM_BLOCK, sizeof(float));
+	// nothing to claim until the first fork
+	atomic_store(&harm->claim, 0xff);
+	atomic_store(&harm->running, true);
+	harm->workers = (pthread_t*)malloc(sizeof(pthread_t) * numWorkers);
+	harm->workerArgs = (HarmWorker*)malloc(sizeof(HarmWorker) * numWorkers);
+	for (int w = 0; w < numWorkers; ++w) {
+		harm->workerArgs[w].harm = harm;
+		sem_init(&harm->workerArgs[w].wake, 0, 0);
+		if (pthread_create(&harm->workers[w], NULL, Harmonizer_worker, &harm->workerArgs[w]) != 0) {
+			sem_destroy(&harm->workerArgs[w].wake);
+			harm->numWorkers = w;
+			Harmonizer_stopWorkers(harm);
+			return -1;
+		}
+	}
+	harm->numWorkers = numWorkers;
+	harm->pipelined = pipelined;
+	harm->pending = 0;
+	return 0;
+}
+
+// back to running every voice on the calling thread
+void Harmonizer_stopWorkers(Harmonizer* harm) {
+	if (harm->groupOuts == NULL) {
+		return;
+	}
+	Harmonizer_drop(harm);
+	atomic_store(&harm->running, false);
+	for (int w = 0; w < harm->numWorkers; ++w) {
+		sem_post(&harm->workerArgs[w].wake);
+		pthread_join(harm->workers[w], NULL);
+		sem_destroy(&harm->workerArgs[w].wake);
+	}
+	for (int g = 0; g < harm->numGroups; ++g) {
+		free(harm->groupOuts[g]);
+	}
+	free(harm->groupOuts);
+	free(harm->groupStarts);
+	free(harm->pipeIn);
+	free(harm->workers);
+	free(harm->workerArgs);
+	harm->groupOuts = NULL;
+	harm->groupStarts = NULL;
+	harm->pipeIn = NULL;
+	harm->workers = NULL;
+	harm->workerArgs = NULL;
+	harm->numWorkers = 0;
+	harm->numGroups = 0;
+	harm->pipelined = false;
+	Harmonizer_update(harm);
+}
+
+// samples the voices lag the input by, for blocks of the given size
+unsigned long Harmonizer_getLatency(Harmonizer* harm, unsigned long frames) {
+	if (!harm->pipelined) {
+		return 0;
 	}
-	return harmSamp;
+	return frames < HARM_BLOCK ? frames : HARM_BLOCK;
 }
 
 void Harmonizer_destroy(Harmonizer* harm) {
+	Harmonizer_stopWorkers(harm);
+	free(harm->mix);
 	free(harm->shiftAmounts);
 	free(harm->mixAmounts);
+	free(harm->degrees);
+	free(harm->intervals);
 	for (unsigned int i = 0; i < harm->numVoices; ++i) {
 		PShift_destroy(harm->shifters[i]);
 	}
@@ -490,27 +1391,1455 @@ void Harmonizer_destroy(Harmonizer* harm) {
 	free(harm);
 }
 
+/*
+ * EFFECT: FILTER
+ * Butterworth lowpass built from a cascade of second-order sections
+ * in transposed direct form II, like scipy's sosfilt.
+ * All sections run side by side in one vector, each lane working one sample
+ * behind the lane before it, so the cascade adds (sections - 1) samples of latency.
+ * Cutoff changes are interpolated across a block so sensor sweeps don't zipper.
+ */
+#define FILTER_MAX_SECTIONS (4)
+
 typedef struct {
-	Gain* gain;
-	Distortion* distortion;
-	Delay* delay;
-	Harmonizer* harmonizer;
+	int numSections;
+	float cutoff;
+	float newCutoff;
+	int sampleRate;
+
+	// one lane per section, unused lanes pass their input straight through
+	float4 b0, b1, b2, a1, a2;
+	float4 z1, z2;
+	// last output of each lane, fed to the next lane on the following sample
+	float4 pipe;
+
+	bool active;
 }
-Effects;
+Filter;
 
-Effects* Effects_create(Gain* _gain, Distortion* _distortion, Delay* _delay, Harmonizer* _harmonizer) {
-	Effects* fx = (Effects*)malloc(sizeof(Effects));
-	fx->gain = _gain;
-	fx->distortion = _distortion;
-	fx->delay = _delay;
-	fx->harmonizer = _harmonizer;
-	return fx;
+// fills in the biquad coefficients for a Butterworth lowpass at the given cutoff
+static void Filter_design(Filter* f, float cutoff, float4* b0, float4* b1, float4* b2,
+						  float4* a1, float4* a2) {
+	int order = f->numSections * 2;
+	float w0 = 2 * M_PI * cutoff / f->sampleRate;
+	float cosW0 = cos(w0);
+	float sinW0 = sin(w0);
+	*b0 = (float4){1, 1, 1, 1};
+	*b1 = (float4){0, 0, 0, 0};
+	*b2 = (float4){0, 0, 0, 0};
+	*a1 = (float4){0, 0, 0, 0};
+	*a2 = (float4){0, 0, 0, 0};
+	for (int k = 0; k < f->numSections; ++k) {
+		// each section gets the Q of one Butterworth pole pair
+		float q = 1 / (2 * cos((2 * k + 1) * M_PI / (2 * order)));
+		float alpha = sinW0 / (2 * q);
+		float a0 = 1 + alpha;
+		(*b0)[k] = (1 - cosW0) / 2 / a0;
+		(*b1)[k] = (1 - cosW0) / a0;
+		(*b2)[k] = (1 - cosW0) / 2 / a0;
+		(*a1)[k] = -2 * cosW0 / a0;
+		(*a2)[k] = (1 - alpha) / a0;
+	}
 }
 
-void Effects_destroy(Effects* fx) {
-	Gain_destroy(fx->gain);
-	Distortion_destroy(fx->distortion);
-	Delay_destroy(fx->delay);
-	Harmonizer_destroy(fx->harmonizer);
+Filter* Filter_create(int _numSections, float _cutoff, int _sampleRate) {
+	Filter* f = (Filter*)vectorAlloc(sizeof(Filter));
+	f->numSections = _numSections < 1 ? 1 :
+		(_numSections > FILTER_MAX_SECTIONS ? FILTER_MAX_SECTIONS : _numSections);
+	f->cutoff = _cutoff;
+	f->newCutoff = _cutoff;
+	f->sampleRate = _sampleRate;
+	Filter_design(f, f->cutoff, &f->b0, &f->b1, &f->b2, &f->a1, &f->a2);
+	f->z1 = (float4){0, 0, 0, 0};
+	f->z2 = (float4){0, 0, 0, 0};
+	f->pipe = (float4){0, 0, 0, 0};
+	f->active = true;
+	return f;
+}
+
+// picked up at the start of the next block
+void Filter_setCutoff(Filter* f, float _cutoff) {
+	// keep well inside (0, nyquist) or the design falls apart
+	float maxCutoff = f->sampleRate * 0.45f;
+	f->newCutoff = _cutoff < 10 ? 10 : (_cutoff > maxCutoff ? maxCutoff : _cutoff);
 }
 
+float Filter_getCutoff(Filter* f) {
+	return f->cutoff;
+}
+
+void Filter_process(Filter* f, float* buffer, unsigned long frames) {
+	float4 b0 = f->b0, b1 = f->b1, b2 = f->b2, a1 = f->a1, a2 = f->a2;
+	float4 db0 = {0}, db1 = {0}, db2 = {0}, da1 = {0}, da2 = {0};
+	float newCutoff = f->newCutoff;
+	bool sweeping = newCutoff != f->cutoff;
+	if (sweeping) {
+		// walk the coefficients from where they are to the new cutoff over this block
+		float4 t0, t1, t2, ta1, ta2;
+		Filter_design(f, newCutoff, &t0, &t1, &t2, &ta1, &ta2);
+		float step = 1.0f / frames;
+		db0 = (t0 - b0) * step;
+		db1 = (t1 - b1) * step;
+		db2 = (t2 - b2) * step;
+		da1 = (ta1 - a1) * step;
+		da2 = (ta2 - a2) * step;
+	}
+	float4 z1 = f->z1, z2 = f->z2, y = f->pipe;
+	const int4 shiftUp = {0, 0, 1, 2};
+	int last = f->numSections - 1;
+	for (unsigned int i = 0; i < frames; ++i) {
+		// each lane takes the previous lane's last output, lane 0 takes the new sample
+		float4 x = __builtin_shuffle(y, shiftUp);
+		x[0] = buffer[i];
+		y = b0 * x + z1;
+		z1 = b1 * x - a1 * y + z2;
+		z2 = b2 * x - a2 * y;
+		buffer[i] = y[last];
+		if (sweeping) {
+			b0 += db0;
+			b1 += db1;
+			b2 += db2;
+			a1 += da1;
+			a2 += da2;
+		}
+	}
+	f->z1 = z1;
+	f->z2 = z2;
+	f->pipe = y;
+	if (sweeping) {
+		f->b0 = b0;
+		f->b1 = b1;
+		f->b2 = b2;
+		f->a1 = a1;
+		f->a2 = a2;
+		f->cutoff = newCutoff;
+	}
+}
+
+void Filter_destroy(Filter* f) {
+	free(f);
+}
+
+/*
+ * EFFECT: REVERB
+ * Feedback delay network with eight delay lines of mutually prime lengths.
+ * The lines are mixed back into each other through an 8x8 Hadamard matrix
+ * (done as three butterfly stages), and each line has a one-pole lowpass
+ * so highs die away faster than lows. Everything except reading and writing
+ * the lines themselves happens on all eight lines at once as one vector.
+ */
+#define REVERB_LINES (8)
+
+typedef float float8 __attribute__((vector_size(32)));
+typedef int int8 __attribute__((vector_size(32)));
+
+// line lengths at 44.1kHz, scaled for other rates
+static const int reverbLengths[REVERB_LINES] = {1031, 1327, 1523, 1801, 2053, 2311, 2617, 2903};
+
+typedef struct {
+	float decay;
+	float damping;
+	float mix;
+	int sampleRate;
+
+	float* buffer;
+	float* lines[REVERB_LINES];
+	int lengths[REVERB_LINES];
+	int indices[REVERB_LINES];
+
+	// per-line feedback gain that gives the requested decay time
+	float8 gains;
+	// state of each line's damping lowpass
+	float8 lowpass;
+
+	bool active;
+}
+Reverb;
+
+// mixes all eight lines into each other, scaled to keep energy the same
+static inline void hadamard8(float8* v) {
+	float8 x = *v;
+	const int8 swap1 = {1, 0, 3, 2, 5, 4, 7, 6};
+	const int8 swap2 = {2, 3, 0, 1, 6, 7, 4, 5};
+	const int8 swap4 = {4, 5, 6, 7, 0, 1, 2, 3};
+	const float8 sign1 = {1, -1, 1, -1, 1, -1, 1, -1};
+	const float8 sign2 = {1, 1, -1, -1, 1, 1, -1, -1};
+	const float8 sign4 = {1, 1, 1, 1, -1, -1, -1, -1};
+	x = __builtin_shuffle(x, swap1) + x * sign1;
+	x = __builtin_shuffle(x, swap2) + x * sign2;
+	x = __builtin_shuffle(x, swap4) + x * sign4;
+	*v = x * (float)(1 / sqrt(REVERB_LINES));
+}
+
+// decay is the time in seconds for the tail to fall by 60dB
+void Reverb_setDecay(Reverb* rev, float _decay) {
+	rev->decay = _decay > 0.01f ? _decay : 0.01f;
+	for (int i = 0; i < REVERB_LINES; ++i) {
+		// 10^(-3 * length / (decay * sampleRate))
+		float exponent = -3.0f * rev->lengths[i] / (rev->decay * rev->sampleRate);
+		rev->gains[i] = lutExp(exponent * (float)M_LN10);
+	}
+}
+
+// 0 leaves the tail bright, towards 1 it gets darker
+void Reverb_setDamping(Reverb* rev, float _damping) {
+	rev->damping = _damping;
+}
+
+void Reverb_setMix(Reverb* rev, float _mix) {
+	rev->mix = _mix;
+}
+
+Reverb* Reverb_create(float _decay, float _damping, float _mix, int _sampleRate) {
+	LutMath_init();
+	Reverb* rev = (Reverb*)vectorAlloc(sizeof(Reverb));
+	rev->damping = _damping;
+	rev->mix = _mix;
+	rev->sampleRate = _sampleRate;
+
+	int total = 0;
+	for (int i = 0; i < REVERB_LINES; ++i) {
+		rev->lengths[i] = reverbLengths[i] * rev->sampleRate / 44100;
+		total += rev->lengths[i];
+	}
+	// all lines share one allocation
+	rev->buffer = (float*)malloc(sizeof(float) * total);
+	for (int i = 0; i < total; ++i) {
+		rev->buffer[i] = 0;
+	}
+	float* line = rev->buffer;
+	for (int i = 0; i < REVERB_LINES; ++i) {
+		rev->lines[i] = line;
+		rev->indices[i] = 0;
+		line += rev->lengths[i];
+	}
+	rev->lowpass = (float8){0};
+	Reverb_setDecay(rev, _decay);
+	rev->active = true;
+	return rev;
+}
+
+void Reverb_process(Reverb* rev, float* buffer, unsigned long frames) {
+	// feed the input in and take the output out with alternating signs, so it decorrelates
+	const float8 signs = {1, -1, 1, -1, 1, -1, 1, -1};
+	float8 gains = rev->gains;
+	float8 lowpass = rev->lowpass;
+	float damping = rev->damping;
+	float wet = rev->mix / REVERB_LINES;
+	for (unsigned int i = 0; i < frames; ++i) {
+		float8 taps;
+		for (int l = 0; l < REVERB_LINES; ++l) {
+			taps[l] = rev->lines[l][rev->indices[l]];
+		}
+		lowpass += (taps - lowpass) * (1 - damping);
+		float8 feedback = lowpass * gains;
+		hadamard8(&feedback);
+		feedback += signs * buffer[i];
+		float8 out = taps * signs;
+		for (int l = 0; l < REVERB_LINES; ++l) {
+			rev->lines[l][rev->indices[l]] = feedback[l];
+			if (++rev->indices[l] >= rev->lengths[l]) {
+				rev->indices[l] = 0;
+			}
+		}
+		buffer[i] += (out[0] + out[1] + out[2] + out[3] + out[4] + out[5] + out[6] + out[7]) * wet;
+	}
+	rev->lowpass = lowpass;
+}
+
+void Reverb_destroy(Reverb* rev) {
+	free(rev->buffer);
+	free(rev);
+}
+
+/*
+ * LFO BANK
+ * Slow oscillators for modulation effects. Every bank reads the shared sine table,
+ * and each oscillator is just a 32 bit phase that wraps around on its own,
+ * so an LFO costs one add and one interpolated table read per sample.
+ */
+#define LFO_MAX (8)
+
+typedef struct {
+	int numLfos;
+	uint32_t phases[LFO_MAX];
+	uint32_t increment;
+}
+LfoBank;
+
+// oscillators share a rate and are spread evenly around the cycle
+LfoBank* LfoBank_create(int _numLfos, float rate, int sampleRate) {
+	LutMath_init();
+	LfoBank* bank = (LfoBank*)malloc(sizeof(LfoBank));
+	bank->numLfos = _numLfos > LFO_MAX ? LFO_MAX : _numLfos;
+	for (int i = 0; i < bank->numLfos; ++i) {
+		bank->phases[i] = (uint32_t)((double)i / bank->numLfos * 4294967296.0);
+	}
+	bank->increment = (uint32_t)(rate / sampleRate * 4294967296.0);
+	return bank;
+}
+
+void LfoBank_setRate(LfoBank* bank, float rate, int sampleRate) {
+	bank->increment = (uint32_t)(rate / sampleRate * 4294967296.0);
+}
+
+// value in [-1, 1] of oscillator i, without moving it
+static inline float LfoBank_value(LfoBank* bank, int i) {
+	return lutSin(bank->phases[i]);
+}
+
+// moves every oscillator on by one sample
+static inline void LfoBank_advance(LfoBank* bank) {
+	for (int i = 0; i < bank->numLfos; ++i) {
+		bank->phases[i] += bank->increment;
+	}
+}
+
+void LfoBank_destroy(LfoBank* bank) {
+	free(bank);
+}
+
+/*
+ * EFFECT: CHORUS
+ * Several modulated taps reading one FracDelay line, each tap swept by its own
+ * phase of a shared LFO bank. Writing once and reading N times keeps a
+ * multi-voice chorus close to the cost of one harmonizer voice.
+ */
+typedef struct {
+	int numVoices;
+	float baseDelay;
+	float depth;
+	float mix;
+	int sampleRate;
+
+	FracDelay* delay;
+	LfoBank* lfos;
+
+	bool active;
+}
+Chorus;
+
+// delays and depth are in milliseconds, rate in Hz
+Chorus* Chorus_create(int _numVoices, float baseMs, float depthMs, float rate, float _mix,
+					  int _sampleRate) {
+	Chorus* chorus = (Chorus*)malloc(sizeof(Chorus));
+	chorus->numVoices = _numVoices > LFO_MAX ? LFO_MAX : _numVoices;
+	chorus->sampleRate = _sampleRate;
+	chorus->baseDelay = baseMs * chorus->sampleRate / 1000;
+	chorus->depth = depthMs * chorus->sampleRate / 1000;
+	chorus->mix = _mix;
+	chorus->delay = FracDelay_create(0, chorus->sampleRate);
+	chorus->lfos = LfoBank_create(chorus->numVoices, rate, chorus->sampleRate);
+	chorus->active = true;
+	return chorus;
+}
+
+void Chorus_setRate(Chorus* chorus, float rate) {
+	LfoBank_setRate(chorus->lfos, rate, chorus->sampleRate);
+}
+
+void Chorus_setMix(Chorus* chorus, float _mix) {
+	chorus->mix = _mix;
+}
+
+void Chorus_process(Chorus* chorus, float* buffer, unsigned long frames) {
+	float wetGain = chorus->mix / chorus->numVoices;
+	for (unsigned int i = 0; i < frames; ++i) {
+		FracDelay_write(chorus->delay, buffer[i]);
+		float wet = 0;
+		for (int v = 0; v < chorus->numVoices; ++v) {
+			float delaySamps = chorus->baseDelay + chorus->depth * LfoBank_value(chorus->lfos, v);
+			wet += FracDelay_read(chorus->delay, delaySamps);
+		}
+		LfoBank_advance(chorus->lfos);
+		buffer[i] = buffer[i] * (1 - chorus->mix) + wet * wetGain;
+	}
+}
+
+void Chorus_destroy(Chorus* chorus) {
+	FracDelay_destroy(chorus->delay);
+	LfoBank_destroy(chorus->lfos);
+	free(chorus);
+}
+
+/*
+ * EFFECT: FLANGER
+ * One short modulated tap off a FracDelay with feedback, swept by the same
+ * table LFO as the chorus.
+ */
+typedef struct {
+	float baseDelay;
+	float depth;
+	float feedback;
+	float mix;
+	int sampleRate;
+
+	FracDelay* delay;
+	LfoBank* lfo;
+	float lastOut;
+
+	bool active;
+}
+Flanger;
+
+// delays and depth are in milliseconds, rate in Hz
+Flanger* Flanger_create(float baseMs, float depthMs, float rate, float _feedback, float _mix,
+						int _sampleRate) {
+	Flanger* flanger = (Flanger*)malloc(sizeof(Flanger));
+	flanger->sampleRate = _sampleRate;
+	flanger->baseDelay = baseMs * flanger->sampleRate / 1000;
+	flanger->depth = depthMs * flanger->sampleRate / 1000;
+	flanger->feedback = _feedback;
+	flanger->mix = _mix;
+	flanger->delay = FracDelay_create(0, flanger->sampleRate);
+	flanger->lfo = LfoBank_create(1, rate, flanger->sampleRate);
+	flanger->lastOut = 0;
+	flanger->active = true;
+	return flanger;
+}
+
+void Flanger_setRate(Flanger* flanger, float rate) {
+	LfoBank_setRate(flanger->lfo, rate, flanger->sampleRate);
+}
+
+void Flanger_setFeedback(Flanger* flanger, float _feedback) {
+	flanger->feedback = _feedback;
+}
+
+void Flanger_process(Flanger* flanger, float* buffer, unsigned long frames) {
+	for (unsigned int i = 0; i < frames; ++i) {
+		FracDelay_write(flanger->delay, buffer[i] + flanger->feedback * flanger->lastOut);
+		float delaySamps = flanger->baseDelay + flanger->depth * LfoBank_value(flanger->lfo, 0);
+		flanger->lastOut = FracDelay_read(flanger->delay, delaySamps);
+		LfoBank_advance(flanger->lfo);
+		buffer[i] = buffer[i] * (1 - flanger->mix) + flanger->lastOut * flanger->mix;
+	}
+}
+
+void Flanger_destroy(Flanger* flanger) {
+	FracDelay_destroy(flanger->delay);
+	LfoBank_destroy(flanger->lfo);
+	free(flanger);
+}
+
+/*
+ * EFFECT: DOPPLER
+ * Pitch bends with how fast the hand moves, like a sound source moving toward
+ * or away from the listener. A sawtooth phase accumulator sweeps the read
+ * position of a FracDelay, and the sweep speed sets the pitch ratio.
+ * Two taps half a cycle apart are crossfaded with a sine-squared window
+ * so the sawtooth's jump back never clicks. When the hand is still the
+ * effect fades itself out, so it's silent until there's motion.
+ */
+// length of the sawtooth sweep, in seconds
+#define DOPPLER_WINDOW (0.05f)
+// per-sample smoothing of the sweep speed, keeps sensor steps from zippering
+#define DOPPLER_SMOOTHING (0.0005f)
+
+typedef struct {
+	// effective speed of sound in cm/s, lower means hand motion bends pitch further
+	float soundSpeed;
+	int sampleRate;
+	float window;
+
+	FracDelay* delay;
+	// sawtooth position in [0, 1), and how far it moves each sample
+	float phase;
+	float increment;
+	float newIncrement;
+	float wet;
+
+	bool active;
+}
+Doppler;
+
+Doppler* Doppler_create(float _soundSpeed, int _sampleRate) {
+	LutMath_init();
+	Doppler* dop = (Doppler*)malloc(sizeof(Doppler));
+	dop->soundSpeed = _soundSpeed;
+	dop->sampleRate = _sampleRate;
+	dop->window = DOPPLER_WINDOW * dop->sampleRate;
+	dop->delay = FracDelay_create(0, dop->sampleRate);
+	dop->phase = 0;
+	dop->increment = 0;
+	dop->newIncrement = 0;
+	dop->wet = 0;
+	dop->active = true;
+	return dop;
+}
+
+// velocity in cm/s, negative when the hand is coming closer
+void Doppler_setVelocity(Doppler* dop, float velocity) {
+	// pitch ratio is 1 - (delay change per sample), and a source moving at v
+	// is heard at c / (c + v), so the delay has to move by v / (c + v) per sample
+	float ratio = dop->soundSpeed / (dop->soundSpeed + velocity);
+	// keep it within an octave either way
+	ratio = ratio < 0.5f ? 0.5f : (ratio > 2 ? 2 : ratio);
+	dop->newIncrement = (1 - ratio) / dop->window;
+}
+
+// sin^2 of pi * phase, from the shared sine table
+static inline float dopplerWindow(float phase) {
+	float value = lutSin((uint32_t)(phase * 2147483648.0f));
+	return value * value;
+}
+
+void Doppler_process(Doppler* dop, float* buffer, unsigned long frames) {
+	float target = dop->newIncrement;
+	// a shift smaller than this isn't worth the comb filtering of two taps
+	float fullWet = 0.01f / dop->window;
+	for (unsigned int i = 0; i < frames; ++i) {
+		dop->increment += (target - dop->increment) * DOPPLER_SMOOTHING;
+		float wetTarget = fabsf(dop->increment) > fullWet ? 1 : fabsf(dop->increment) / fullWet;
+		dop->wet += (wetTarget - dop->wet) * DOPPLER_SMOOTHING;
+
+		FracDelay_write(dop->delay, buffer[i]);
+		if (dop->wet < 1e-4f) {
+			continue;
+		}
+		dop->phase += dop->increment;
+		if (dop->phase >= 1) {
+			dop->phase -= 1;
+		}
+		else if (dop->phase < 0) {
+			dop->phase += 1;
+		}
+		float phase2 = dop->phase + 0.5f;
+		if (phase2 >= 1) {
+			phase2 -= 1;
+		}
+		// +1 keeps both taps at least a whole sample back, where FracDelay_read is valid
+		float tap1 = FracDelay_read(dop->delay, dop->phase * dop->window + 1);
+		float tap2 = FracDelay_read(dop->delay, phase2 * dop->window + 1);
+		float shifted = tap1 * dopplerWindow(dop->phase) + tap2 * dopplerWindow(phase2);
+		buffer[i] += (shifted - buffer[i]) * dop->wet;
+	}
+}
+
+void Doppler_destroy(Doppler* dop) {
+	FracDelay_destroy(dop->delay);
+	free(dop);
+}
+
+/*
+ * EFFECT: FREQUENCY SHIFTER
+ * Single-sideband shift: every partial moves up or down by the same number of Hz,
+ * which detunes harmonics from each other for an inharmonic, metallic sound.
+ * The 90 degree phase split is a pair of allpass chains (Olli Niemitalo's
+ * Hilbert coefficients), and a sine table oscillator supplies the quadrature
+ * carrier. Both chains' sections sit in one eight-lane vector and run as a
+ * pipeline like the Filter, so there are no delay lines and no crossfades.
+ */
+typedef struct {
+	float shift;
+	float mix;
+	int sampleRate;
+
+	uint32_t phase;
+	uint32_t increment;
+
+	// lanes 0-3 are the in-phase chain, lanes 4-7 the quadrature chain
+	float8 coefs;
+	float8 x1, x2, y1, y2;
+	float8 pipe;
+
+	bool active;
+}
+FreqShift;
+
+// in Hz, negative shifts down
+void FreqShift_setShift(FreqShift* fs, float _shift) {
+	fs->shift = _shift;
+	fs->increment = (uint32_t)(int32_t)(fs->shift / fs->sampleRate * 4294967296.0);
+}
+
+FreqShift* FreqShift_create(float _shift, float _mix, int _sampleRate) {
+	LutMath_init();
+	FreqShift* fs = (FreqShift*)vectorAlloc(sizeof(FreqShift));
+	fs->sampleRate = _sampleRate;
+	fs->mix = _mix;
+	fs->phase = 0;
+	// each section is y[n] = a^2 (x[n] + y[n-2]) - x[n-2]
+	const float a[8] = {0.6923878f, 0.9360654322959f, 0.9882295226860f, 0.9987488452737f,
+						0.4021921162426f, 0.8561710882420f, 0.9722909545651f, 0.9952884791278f};
+	for (int i = 0; i < 8; ++i) {
+		fs->coefs[i] = a[i] * a[i];
+	}
+	fs->x1 = fs->x2 = fs->y1 = fs->y2 = fs->pipe = (float8){0};
+	FreqShift_setShift(fs, _shift);
+	fs->active = true;
+	return fs;
+}
+
+void FreqShift_setMix(FreqShift* fs, float _mix) {
+	fs->mix = _mix;
+}
+
+void FreqShift_process(FreqShift* fs, float* buffer, unsigned long frames) {
+	// lane 4 takes the new sample, lane 0 the previous one, which is the in-phase
+	// chain's extra sample of delay; every other lane takes the lane before it
+	const int8 shiftUp = {0, 0, 1, 2, 0, 4, 5, 6};
+	float8 coefs = fs->coefs;
+	float8 x1 = fs->x1, x2 = fs->x2, y1 = fs->y1, y2 = fs->y2, y = fs->pipe;
+	float lastIn = fs->x1[4];
+	for (unsigned int i = 0; i < frames; ++i) {
+		float8 x = __builtin_shuffle(y, shiftUp);
+		x[0] = lastIn;
+		x[4] = buffer[i];
+		lastIn = buffer[i];
+		y = coefs * (x + y2) - x2;
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		// real part of the analytic signal times e^(jwt), this Q chain comes out negated
+		float shifted = y[3] * lutSin(fs->phase + 0x40000000u) + y[7] * lutSin(fs->phase);
+		fs->phase += fs->increment;
+		buffer[i] += (shifted - buffer[i]) * fs->mix;
+	}
+	fs->x1 = x1;
+	fs->x2 = x2;
+	fs->y1 = y1;
+	fs->y2 = y2;
+	fs->pipe = y;
+}
+
+void FreqShift_destroy(FreqShift* fs) {
+	free(fs);
+}
+
+/*
+ * EFFECT: LOOPER
+ * Records, overdubs and plays back loops, at normal or half speed.
+ * Loop audio lives in a memory-mapped file rather than on the heap, so a loop
+ * can run for minutes without all of it sitting in RAM. The audio thread never
+ * touches the mapping though: writeback write-protects a shared mapping's pages
+ * again, and the next store to one faults. It reads and writes a handful of
+ * locked anonymous slots instead, one block each, and the control thread's
+ * Looper_page() copies blocks in from the file ahead of the play position and
+ * writes the ones it has passed back out. A loop shorter than the slots hold
+ * just stays in them.
+ */
+// size of each chunk of the file that gets copied in or out as a unit, in seconds
+#define LOOP_BLOCK_SECONDS (1)
+// how much to keep in slots ahead of and behind the play position, in blocks
+#define LOOP_BLOCKS_AHEAD (4)
+#define LOOP_BLOCKS_BEHIND (1)
+// the window around the play position, plus the start of the loop for when a recording begins or ends
+#define LOOP_SLOTS (2 * (LOOP_BLOCKS_AHEAD + 1) + LOOP_BLOCKS_BEHIND)
+
+typedef enum {
+	LOOP_IDLE,
+	LOOP_RECORDING,
+	LOOP_PLAYING,
+	LOOP_OVERDUBBING
+}
+LoopState;
+
+typedef struct {
+	int sampleRate;
+	float mix;
+
+	int fd;
+	// the file, only the control thread touches it
+	StoredSample* buffer;
+	size_t capacity;
+	// loop length in samples, 0 until something has been recorded. the audio
+	// thread sets it, and publishes it along with accepted
+	_Atomic size_t length;
+	double position;
+	float speed;
+
+	// the audio thread's own copy of the state it's in
+	LoopState state;
+	// the last state asked for, a count of requests << 8 | LoopState, so asking
+	// for the same thing twice is two requests. only the control thread writes it
+	_Atomic uint32_t request;
+	// the count of the last request the audio thread took << 8 | the state it went
+	// into, which is LOOP_IDLE if there was no loop to play. only the audio thread writes it
+	_Atomic uint32_t accepted;
+	volatile float newSpeed;
+	// play position as a whole sample, for the control thread to page around;
+	// stored with release so it also hands over the slot writes before it
+	_Atomic size_t playIndex;
+
+	size_t blockSamples;
+	int numBlocks;
+	// LOOP_SLOTS blocks of locked memory, the only loop audio the audio thread sees
+	StoredSample* slots;
+	// which slot each block is in, or -1; the control thread publishes, the audio thread looks up
+	_Atomic int* slotOf;
+	// which block each slot holds, or -1, control thread only
+	int slotBlock[LOOP_SLOTS];
+	// set by the audio thread when it writes into a slot, so only those get copied back
+	volatile bool slotDirty[LOOP_SLOTS];
+
+	bool active;
+}
+Looper;
+
+// seconds is the longest loop, the file at path is created or overwritten
+Looper* Looper_create(const char* path, float seconds, float _mix, int _sampleRate) {
+	Looper* lp = (Looper*)malloc(sizeof(Looper));
+	lp->sampleRate = _sampleRate;
+	lp->mix = _mix;
+	lp->blockSamples = LOOP_BLOCK_SECONDS * lp->sampleRate;
+	lp->numBlocks = (int)ceil(seconds / LOOP_BLOCK_SECONDS);
+	lp->capacity = lp->numBlocks * lp->blockSamples;
+
+	lp->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (lp->fd < 0) {
+		perror(path);
+		free(lp);
+		return NULL;
+	}
+	// sparse, so it only takes disk space as it gets recorded into
+	if (ftruncate(lp->fd, lp->capacity * sizeof(StoredSample)) != 0) {
+		perror(path);
+		close(lp->fd);
+		free(lp);
+		return NULL;
+	}
+	// only the slots are locked. under mlockall(MCL_FUTURE) a readable mapping would be
+	// read in and pinned whole, but an inaccessible one isn't, so map it that way, take
+	// it out of the lock and only then open it up
+	size_t fileBytes = lp->capacity * sizeof(StoredSample);
+	lp->buffer = (StoredSample*)mmap(NULL, fileBytes, PROT_NONE, MAP_SHARED, lp->fd, 0);
+	if (lp->buffer == MAP_FAILED) {
+		perror("looper mmap");
+		close(lp->fd);
+		free(lp);
+		return NULL;
+	}
+	munlock(lp->buffer, fileBytes);
+	if (mprotect(lp->buffer, fileBytes, PROT_READ | PROT_WRITE) != 0) {
+		perror("looper mprotect");
+		munmap(lp->buffer, fileBytes);
+		close(lp->fd);
+		free(lp);
+		return NULL;
+	}
+	// we page it ourselves, the kernel's readahead guesses would only get in the way
+	madvise(lp->buffer, fileBytes, MADV_RANDOM);
+
+	size_t slotBytes = LOOP_SLOTS * lp->blockSamples * sizeof(StoredSample);
+	lp->slots = (StoredSample*)mmap(NULL, slotBytes, PROT_READ | PROT_WRITE,
+									MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (lp->slots == MAP_FAILED) {
+		perror("looper slots");
+		munmap(lp->buffer, lp->capacity * sizeof(StoredSample));
+		close(lp->fd);
+		free(lp);
+		return NULL;
+	}
+	// anonymous pages are never written back, so once faulted in and locked they stay writable
+	if (mlock(lp->slots, slotBytes) != 0) {
+		perror("looper mlock");
+	}
+	prefaultMemory(lp->slots, slotBytes);
+	lp->slotOf = (_Atomic int*)malloc(sizeof(_Atomic int) * lp->numBlocks);
+	for (int i = 0; i < lp->numBlocks; ++i) {
+		atomic_init(&lp->slotOf[i], -1);
+	}
+	for (int i = 0; i < LOOP_SLOTS; ++i) {
+		lp->slotBlock[i] = -1;
+		lp->slotDirty[i] = false;
+	}
+
+	atomic_init(&lp->length, 0);
+	lp->position = 0;
+	lp->speed = 1;
+	lp->state = LOOP_IDLE;
+	atomic_init(&lp->request, LOOP_IDLE);
+	atomic_init(&lp->accepted, LOOP_IDLE);
+	lp->newSpeed = 1;
+	atomic_init(&lp->playIndex, 0);
+	lp->active = true;
+	return lp;
+}
+
+// copies a block from the file into a free slot and hands it to the audio thread
+static void Looper_loadBlock(Looper* lp, int block) {
+	int slot = 0;
+	while (slot < LOOP_SLOTS && lp->slotBlock[slot] >= 0) {
+		++slot;
+	}
+	if (slot == LOOP_SLOTS) {
+		return;
+	}
+	memcpy(lp->slots + slot * lp->blockSamples, lp->buffer + block * lp->blockSamples,
+		   lp->blockSamples * sizeof(StoredSample));
+	lp->slotBlock[slot] = block;
+	lp->slotDirty[slot] = false;
+	atomic_store_explicit(&lp->slotOf[block], slot, memory_order_release);
+}
+
+// takes a block the audio thread has moved away from back, writing it to the file if it changed
+static void Looper_evictBlock(Looper* lp, int block) {
+	int slot = atomic_load_explicit(&lp->slotOf[block], memory_order_relaxed);
+	atomic_store_explicit(&lp->slotOf[block], -1, memory_order_relaxed);
+	if (lp->slotDirty[slot]) {
+		memcpy(lp->buffer + block * lp->blockSamples, lp->slots + slot * lp->blockSamples,
+			   lp->blockSamples * sizeof(StoredSample));
+	}
+	lp->slotBlock[slot] = -1;
+}
+
+// call regularly from the control thread to keep the blocks around the play position in slots
+void Looper_page(Looper* lp) {
+	uint32_t request = atomic_load_explicit(&lp->request, memory_order_relaxed);
+	uint32_t accepted = atomic_load_explicit(&lp->accepted, memory_order_acquire);
+	LoopState pending = request & 0xff;
+	LoopState state = accepted & 0xff;
+	if (pending == LOOP_IDLE && state == LOOP_IDLE) {
+		return;
+	}
+	// pairs with the audio thread's release, so its slot writes are visible before we copy them out
+	size_t playIndex = atomic_load_explicit(&lp->playIndex, memory_order_acquire);
+	size_t length = atomic_load_explicit(&lp->length, memory_order_relaxed);
+	// while recording the loop ends wherever the buffer does
+	int wrapBlocks = lp->numBlocks;
+	if (length > 0 && state != LOOP_RECORDING) {
+		wrapBlocks = (length + lp->blockSamples - 1) / lp->blockSamples;
+	}
+	int current = playIndex / lp->blockSamples;
+	// starting or finishing a recording sends the audio thread back to the top
+	bool restarting = (request >> 8) != (accepted >> 8) &&
+					  (pending == LOOP_RECORDING || state == LOOP_RECORDING);
+	// evict before loading, so the blocks falling behind free up slots for the ones coming up
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int block = 0; block < lp->numBlocks; ++block) {
+			// how far ahead of the play position this block is, going round the loop
+			int ahead = block < wrapBlocks ? (block - current + wrapBlocks) % wrapBlocks : -1;
+			bool wanted = ahead >= 0 && (ahead <= LOOP_BLOCKS_AHEAD ||
+										 ahead >= wrapBlocks - LOOP_BLOCKS_BEHIND);
+			// keep the top in too until the audio thread has actually gone back there
+			wanted = wanted || (restarting && block <= LOOP_BLOCKS_AHEAD);
+			bool loaded = atomic_load_explicit(&lp->slotOf[block], memory_order_relaxed) >= 0;
+			if (pass == 0 && !wanted && loaded) {
+				Looper_evictBlock(lp, block);
+			}
+			else if (pass == 1 && wanted && !loaded) {
+				Looper_loadBlock(lp, block);
+			}
+		}
+	}
+}
+
+// bring the start of the loop into slots before the audio thread gets there
+static void Looper_lockStart(Looper* lp) {
+	for (int block = 0; block <= LOOP_BLOCKS_AHEAD && block < lp->numBlocks; ++block) {
+		if (atomic_load_explicit(&lp->slotOf[block], memory_order_relaxed) < 0) {
+			Looper_loadBlock(lp, block);
+		}
+	}
+}
+
+// control thread only, the audio thread picks it up at the start of the next block
+static void Looper_request(Looper* lp, LoopState newState) {
+	uint32_t count = (atomic_load_explicit(&lp->request, memory_order_relaxed) >> 8) + 1;
+	atomic_store_explicit(&lp->request, (count << 8 | newState), memory_order_release);
+}
+
+// starts a new loop, throwing away the old one
+void Looper_record(Looper* lp) {
+	Looper_lockStart(lp);
+	Looper_request(lp, LOOP_RECORDING);
+}
+
+// ends a recording and starts playing it, or carries on playing after an overdub
+void Looper_play(Looper* lp) {
+	// the loop restarts from the top, which we let go of a while ago
+	if ((atomic_load_explicit(&lp->request, memory_order_relaxed) & 0xff) == LOOP_RECORDING) {
+		Looper_lockStart(lp);
+	}
+	Looper_request(lp, LOOP_PLAYING);
+}
+
+// layers the input on top of the loop as it plays, always at normal speed
+void Looper_overdub(Looper* lp) {
+	lp->newSpeed = 1;
+	Looper_request(lp, LOOP_OVERDUBBING);
+}
+
+// stops playback, the loop is kept for the next Looper_play
+void Looper_stop(Looper* lp) {
+	Looper_request(lp, LOOP_IDLE);
+}
+
+void Looper_setHalfSpeed(Looper* lp, bool halfSpeed) {
+	lp->newSpeed = halfSpeed ? 0.5f : 1;
+}
+
+// the state the audio thread is actually in, a block or so behind the last request
+LoopState Looper_getState(Looper* lp) {
+	return atomic_load_explicit(&lp->accepted, memory_order_acquire) & 0xff;
+}
+
+// audio thread only; count is the request this answers
+static void Looper_changeState(Looper* lp, LoopState newState, uint32_t count) {
+	size_t length = atomic_load_explicit(&lp->length, memory_order_relaxed);
+	if (newState == LOOP_RECORDING) {
+		length = 0;
+		lp->position = 0;
+	}
+	else if (lp->state == LOOP_RECORDING) {
+		// whatever got recorded is the loop now
+		length = (size_t)lp->position;
+		lp->position = 0;
+	}
+	// nothing to play, which the control thread sees in accepted rather than its request
+	if (length == 0 && newState != LOOP_RECORDING) {
+		newState = LOOP_IDLE;
+	}
+	lp->state = newState;
+	atomic_store_explicit(&lp->length, length, memory_order_relaxed);
+	atomic_store_explicit(&lp->accepted, (count << 8 | newState), memory_order_release);
+}
+
+// the slot holding a sample, or -1 if Looper_page hasn't got to it, which only
+// happens if the control thread stalls for seconds; that stretch plays silence
+static inline int Looper_slot(Looper* lp, size_t index, size_t* offset) {
+	size_t block = index / lp->blockSamples;
+	*offset = index - block * lp->blockSamples;
+	return atomic_load_explicit(&lp->slotOf[block], memory_order_acquire);
+}
+
+static inline float Looper_read(Looper* lp, size_t index) {
+	size_t offset;
+	int slot = Looper_slot(lp, index, &offset);
+	return slot >= 0 ? fromStored(lp->slots[slot * lp->blockSamples + offset]) : 0;
+}
+
+void Looper_process(Looper* lp, float* buffer, unsigned long frames) {
+	uint32_t request = atomic_load_explicit(&lp->request, memory_order_acquire);
+	uint32_t taken = atomic_load_explicit(&lp->accepted, memory_order_relaxed) >> 8;
+	if ((request >> 8) != taken) {
+		Looper_changeState(lp, request & 0xff, request >> 8);
+	}
+	lp->speed = lp->state == LOOP_OVERDUBBING ? 1 : lp->newSpeed;
+	if (lp->state == LOOP_IDLE) {
+		return;
+	}
+	if (lp->state == LOOP_RECORDING) {
+		size_t index = (size_t)lp->position;
+		size_t count = frames;
+		if (index + count > lp->capacity) {
+			count = lp->capacity - index;
+		}
+		// a block at a time, they needn't be in neighbouring slots
+		for (size_t done = 0; done < count;) {
+			size_t offset;
+			int slot = Looper_slot(lp, index + done, &offset);
+			size_t n = lp->blockSamples - offset;
+			if (n > count - done) {
+				n = count - done;
+			}
+			if (slot >= 0) {
+				storeSamples(lp->slots + slot * lp->blockSamples + offset, buffer + done, n);
+				lp->slotDirty[slot] = true;
+			}
+			done += n;
+		}
+		lp->position += count;
+		atomic_store_explicit(&lp->playIndex, (size_t)lp->position, memory_order_release);
+		// out of room, start playing what we've got
+		if (lp->position >= lp->capacity) {
+			Looper_changeState(lp, LOOP_PLAYING, taken);
+		}
+		return;
+	}
+	size_t length = atomic_load_explicit(&lp->length, memory_order_relaxed);
+	for (unsigned int i = 0; i < frames; ++i) {
+		size_t index = (size_t)lp->position;
+		size_t next = index + 1 < length ? index + 1 : 0;
+		float frac = lp->position - index;
+		float y0 = Looper_read(lp, index);
+		float looped = y0 + (Looper_read(lp, next) - y0) * frac;
+		if (lp->state == LOOP_OVERDUBBING) {
+			size_t offset;
+			int slot = Looper_slot(lp, index, &offset);
+			if (slot >= 0) {
+				lp->slots[slot * lp->blockSamples + offset] = toStored(looped + buffer[i]);
+				lp->slotDirty[slot] = true;
+			}
+		}
+		buffer[i] += looped * lp->mix;
+		lp->position += lp->speed;
+		if (lp->position >= length) {
+			lp->position -= length;
+		}
+	}
+	atomic_store_explicit(&lp->playIndex, (size_t)lp->position, memory_order_release);
+}
+
+// writes back whatever is still in slots, so the file holds the whole loop
+void Looper_destroy(Looper* lp) {
+	for (int block = 0; block < lp->numBlocks; ++block) {
+		if (atomic_load_explicit(&lp->slotOf[block], memory_order_relaxed) >= 0) {
+			Looper_evictBlock(lp, block);
+		}
+	}
+	munmap(lp->slots, LOOP_SLOTS * lp->blockSamples * sizeof(StoredSample));
+	munmap(lp->buffer, lp->capacity * sizeof(StoredSample));
+	close(lp->fd);
+	free(lp->slotOf);
+	free(lp);
+}
+
+/*
+ * ENVELOPE FOLLOWER
+ * Tracks the level of a signal, either its peak or its RMS, rising at the
+ * attack rate and falling at the release rate. RMS averages the square over
+ * a fixed window first; the ballistics only come after the square root, since
+ * attacking faster than releasing on the square itself reads several dB hot. The compressor uses one as its
+ * detector, and it works as a modulation source on its own: the last level of
+ * every block is published for the sensor thread, or anything else, to read.
+ */
+typedef enum {
+	ENV_PEAK,
+	ENV_RMS
+}
+EnvMode;
+
+#define ENV_RMS_WINDOW (0.01f)
+
+typedef struct {
+	EnvMode mode;
+	int sampleRate;
+	float attackCoef;
+	float releaseCoef;
+	float rmsCoef;
+	float meanSquare;
+	float state;
+	volatile float level;
+}
+EnvFollower;
+
+void EnvFollower_setTimes(EnvFollower* env, float attackSeconds, float releaseSeconds) {
+	env->attackCoef = onePoleCoef(attackSeconds, env->sampleRate);
+	env->releaseCoef = onePoleCoef(releaseSeconds, env->sampleRate);
+}
+
+EnvFollower* EnvFollower_create(EnvMode _mode, float attackSeconds, float releaseSeconds, int _sampleRate) {
+	LutMath_init();
+	EnvFollower* env = (EnvFollower*)malloc(sizeof(EnvFollower));
+	env->mode = _mode;
+	env->sampleRate = _sampleRate;
+	EnvFollower_setTimes(env, attackSeconds, releaseSeconds);
+	env->rmsCoef = onePoleCoef(ENV_RMS_WINDOW, env->sampleRate);
+	env->meanSquare = 0;
+	env->state = 0;
+	env->level = 0;
+	return env;
+}
+
+// writes the level at every sample of in to levels, which may be NULL
+void EnvFollower_process(EnvFollower* env, const float* in, float* levels, unsigned long frames) {
+	float state = env->state;
+	float meanSquare = env->meanSquare;
+	float attack = env->attackCoef;
+	float release = env->releaseCoef;
+	float rmsCoef = env->rmsCoef;
+	bool rms = env->mode == ENV_RMS;
+	for (unsigned int i = 0; i < frames; ++i) {
+		float x = fabsf(in[i]);
+		if (rms) {
+			meanSquare += (in[i] * in[i] - meanSquare) * rmsCoef;
+			x = sqrtf(meanSquare);
+		}
+		state += (x - state) * (x > state ? attack : release);
+		if (levels != NULL) {
+			levels[i] = state;
+		}
+	}
+	env->state = state;
+	env->meanSquare = meanSquare;
+	env->level = state;
+}
+
+// safe to call from any thread, lags by up to a block
+float EnvFollower_getLevel(EnvFollower* env) {
+	return env->level;
+}
+
+void EnvFollower_destroy(EnvFollower* env) {
+	free(env);
+}
+
+/*
+ * EFFECT: COMPRESSOR
+ * Feed-forward compressor to even out the jumps from sensor gain changes and
+ * harmony voices coming in. An EnvFollower supplies the level; everything
+ * after that runs a sub-block at a time: levels go to the log domain through
+ * the lookup tables, the gain curve (threshold, ratio and a soft knee) is
+ * worked out four samples at a time, and the gains come back out through the
+ * tables. Levels are kept in log2 rather than dB internally, which is the
+ * same curve with the 20 log10(2) factor folded into the settings.
+ */
+#define COMP_BLOCK (64)
+#define DB_PER_LOG2 (6.0205999f)
+
+typedef struct {
+	EnvFollower* follower;
+	// all in log2 units
+	float threshold;
+	float knee;
+	float makeup;
+	// 1 / ratio - 1, how much of the excess over the threshold is taken off
+	float slope;
+
+	float levels[COMP_BLOCK];
+	bool active;
+}
+Compressor;
+
+void Compressor_setThreshold(Compressor* comp, float thresholdDb) {
+	comp->threshold = thresholdDb / DB_PER_LOG2;
+}
+
+void Compressor_setRatio(Compressor* comp, float ratio) {
+	comp->slope = 1 / ratio - 1;
+}
+
+// width of the knee in dB, 0 for a hard knee
+void Compressor_setKnee(Compressor* comp, float kneeDb) {
+	comp->knee = kneeDb / DB_PER_LOG2;
+}
+
+void Compressor_setMakeup(Compressor* comp, float makeupDb) {
+	comp->makeup = makeupDb / DB_PER_LOG2;
+}
+
+Compressor* Compressor_create(EnvMode mode, float thresholdDb, float ratio, float attackSeconds,
+							  float releaseSeconds, float makeupDb, int _sampleRate) {
+	Compressor* comp = (Compressor*)malloc(sizeof(Compressor));
+	comp->follower = EnvFollower_create(mode, attackSeconds, releaseSeconds, _sampleRate);
+	Compressor_setThreshold(comp, thresholdDb);
+	Compressor_setRatio(comp, ratio);
+	Compressor_setKnee(comp, 6);
+	Compressor_setMakeup(comp, makeupDb);
+	comp->active = true;
+	return comp;
+}
+
+// gain reduction in log2 for four levels, already in log2
+static inline float4 compressorCurve(Compressor* comp, float4 level) {
+	float halfKnee = comp->knee * 0.5f;
+	float4 over = level - comp->threshold;
+	float4 hard = over * comp->slope;
+	// inside the knee the curve is a parabola joining 0 and the hard slope
+	float4 inKnee = over + halfKnee;
+	float4 soft = inKnee * inKnee * (comp->slope / (2 * comp->knee + 1e-9f));
+	const float4 zero = {0, 0, 0, 0};
+	// no vector ternary in C, so pick lanes with the comparison masks
+	int4 below = over <= -halfKnee;
+	int4 above = over >= halfKnee;
+	int4 knee = ~(below | above);
+	return (float4)(((int4)zero & below) | ((int4)hard & above) | ((int4)soft & knee));
+}
+
+void Compressor_process(Compressor* comp, float* buffer, unsigned long frames) {
+	float* levels = comp->levels;
+	for (unsigned long start = 0; start < frames; start += COMP_BLOCK) {
+		unsigned long count = frames - start < COMP_BLOCK ? frames - start : COMP_BLOCK;
+		float* block = buffer + start;
+		EnvFollower_process(comp->follower, block, levels, count);
+		// the log of silence is -inf, the floor keeps it at about -180 dB
+		for (unsigned int i = 0; i < count; ++i) {
+			levels[i] = lutLog2(levels[i] + 1e-9f);
+		}
+		// a partial block still runs whole vectors, the extra lanes are never used
+		for (unsigned int i = count; i < (count + 3) / 4 * 4; ++i) {
+			levels[i] = 0;
+		}
+		for (unsigned int i = 0; i < count; i += 4) {
+			float4 level;
+			memcpy(&level, levels + i, sizeof(level));
+			float4 gain = compressorCurve(comp, level) + comp->makeup;
+			memcpy(levels + i, &gain, sizeof(gain));
+		}
+		for (unsigned int i = 0; i < count; ++i) {
+			block[i] *= lutExp2(levels[i]);
+		}
+	}
+}
+
+void Compressor_destroy(Compressor* comp) {
+	EnvFollower_destroy(comp->follower);
+	free(comp);
+}
+
+/*
+ * EFFECT: LIMITER
+ * Brickwall lookahead limiter for the very end of the chain, so harmony voices
+ * stacked on the dry signal and delay feedback can't push the output past
+ * full scale. The gain each sample needs is held for the length of the
+ * lookahead, dips instantly and recovers at the release rate, then a moving
+ * average over the lookahead ramps it down before the peak arrives. The audio
+ * is delayed to match, so the limiter adds the lookahead to the latency.
+ * The held peak comes from a sliding window maximum kept in a monotonic
+ * deque: each sample goes in and out of it once, so the cost per sample
+ * doesn't grow with the lookahead.
+ */
+typedef struct {
+	float threshold;
+	float releaseCoef;
+	int lookahead;
+
+	// the audio waiting for its gain, and the gains being averaged
+	float* delay;
+	float* gains;
+	int pos;
+	double gainSum;
+	float envelope;
+
+	// candidates for the window maximum, oldest first and strictly decreasing
+	float* peaks;
+	uint32_t* peakTimes;
+	uint32_t dequeMask;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t time;
+
+	bool active;
+}
+Limiter;
+
+Limiter* Limiter_create(float _threshold, float lookaheadSeconds, float releaseSeconds, int _sampleRate) {
+	Limiter* lim = (Limiter*)malloc(sizeof(Limiter));
+	lim->threshold = _threshold;
+	lim->releaseCoef = onePoleCoef(releaseSeconds, _sampleRate);
+	lim->lookahead = lookaheadSeconds * _sampleRate;
+	if (lim->lookahead < 1) {
+		lim->lookahead = 1;
+	}
+	lim->delay = (float*)calloc(lim->lookahead, sizeof(float));
+	lim->gains = (float*)malloc(sizeof(float) * lim->lookahead);
+	for (int i = 0; i < lim->lookahead; ++i) {
+		lim->gains[i] = 1;
+	}
+	lim->pos = 0;
+	lim->gainSum = lim->lookahead;
+	lim->envelope = 1;
+	// the window is one longer than the average, so it covers the sample leaving the delay,
+	// and the deque never holds more than the window. a power of 2 so its indexes can run
+	// freely and be masked
+	uint32_t capacity = 1;
+	while (capacity < (uint32_t)lim->lookahead + 1) {
+		capacity <<= 1;
+	}
+	lim->peaks = (float*)malloc(sizeof(float) * capacity);
+	lim->peakTimes = (uint32_t*)malloc(sizeof(uint32_t) * capacity);
+	lim->dequeMask = capacity - 1;
+	lim->head = 0;
+	lim->tail = 0;
+	lim->time = 0;
+	lim->active = true;
+	return lim;
+}
+
+void Limiter_setThreshold(Limiter* lim, float _threshold) {
+	lim->threshold = _threshold;
+}
+
+// samples the output is held back by
+int Limiter_getLatency(Limiter* lim) {
+	return lim->lookahead;
+}
+
+void Limiter_process(Limiter* lim, float* buffer, unsigned long frames) {
+	float threshold = lim->threshold;
+	for (unsigned int i = 0; i < frames; ++i) {
+		float level = fabsf(buffer[i]);
+		// drop the sample leaving the window first, so the deque never holds more than the window
+		if (lim->tail != lim->head &&
+			lim->time - lim->peakTimes[lim->head & lim->dequeMask] > (uint32_t)lim->lookahead) {
+			++lim->head;
+		}
+		// anything no louder than the newcomer can never be the maximum again
+		while (lim->tail != lim->head && lim->peaks[(lim->tail - 1) & lim->dequeMask] <= level) {
+			--lim->tail;
+		}
+		lim->peaks[lim->tail & lim->dequeMask] = level;
+		lim->peakTimes[lim->tail & lim->dequeMask] = lim->time;
+		++lim->tail;
+		++lim->time;
+
+		float peak = lim->peaks[lim->head & lim->dequeMask];
+		float target = peak > threshold ? threshold / peak : 1;
+		if (target < lim->envelope) {
+			lim->envelope = target;
+		}
+		else {
+			lim->envelope += (target - lim->envelope) * lim->releaseCoef;
+		}
+		lim->gainSum += lim->envelope - lim->gains[lim->pos];
+		lim->gains[lim->pos] = lim->envelope;
+
+		// the oldest sample is the one every gain in the average has seen coming
+		float delayed = lim->delay[lim->pos];
+		lim->delay[lim->pos] = buffer[i];
+		if (++lim->pos >= lim->lookahead) {
+			lim->pos = 0;
+		}
+		buffer[i] = delayed * (float)(lim->gainSum / lim->lookahead);
+	}
+}
+
+void Limiter_destroy(Limiter* lim) {
+	free(lim->delay);
+	free(lim->gains);
+	free(lim->peaks);
+	free(lim->peakTimes);
+	free(lim);
+}
+
+typedef struct {
+	Gain* gain;
+	Distortion* distortion;
+	Delay* delay;
+	Harmonizer* harmonizer;
+	Filter* filter;
+	Reverb* reverb;
+	Chorus* chorus;
+	Flanger* flanger;
+	Doppler* doppler;
+	FreqShift* freqShift;
+	Looper* looper;
+	Limiter* limiter;
+	Compressor* compressor;
+}
+Effects;
+
+Effects* Effects_create(Gain* _gain, Distortion* _distortion, Delay* _delay, Harmonizer* _harmonizer,
+						Filter* _filter, Reverb* _reverb, Chorus* _chorus, Flanger* _flanger,
+						Doppler* _doppler, FreqShift* _freqShift, Looper* _looper, Limiter* _limiter,
+						Compressor* _compressor) {
+	Effects* fx = (Effects*)malloc(sizeof(Effects));
+	fx->gain = _gain;
+	fx->distortion = _distortion;
+	fx->delay = _delay;
+	fx->harmonizer = _harmonizer;
+	fx->filter = _filter;
+	fx->reverb = _reverb;
+	fx->chorus = _chorus;
+	fx->flanger = _flanger;
+	fx->doppler = _doppler;
+	fx->freqShift = _freqShift;
+	fx->looper = _looper;
+	fx->limiter = _limiter;
+	fx->compressor = _compressor;
+	return fx;
+}
+
+void Effects_destroy(Effects* fx) {
+	Gain_destroy(fx->gain);
+	Distortion_destroy(fx->distortion);
+	Delay_destroy(fx->delay);
+	Harmonizer_destroy(fx->harmonizer);
+	Filter_destroy(fx->filter);
+	Reverb_destroy(fx->reverb);
+	Chorus_destroy(fx->chorus);
+	Flanger_destroy(fx->flanger);
+	Doppler_destroy(fx->doppler);
+	FreqShift_destroy(fx->freqShift);
+	if (fx->looper != NULL) {
+		Looper_destroy(fx->looper);
+	}
+	Limiter_destroy(fx->limiter);
+	Compressor_destroy(fx->compressor);
+}
+
+
+// runs one block through the whole chain, in and out may point at the same buffer
+void Effects_process(Effects* fx, const float* in, float* out, unsigned long frames) {
+	for (unsigned int i = 0; i < frames; ++i) {
+		float sample = in[i];
+		if (fx->gain->active) {
+			sample = Gain_apply(fx->gain, sample);
+		}
+		out[i] = sample;
+	}
+	if (fx->harmonizer->active) {
+		Harmonizer_process(fx->harmonizer, out, frames);
+	}
+	else {
+		Harmonizer_drop(fx->harmonizer);
+	}
+	// evens out gain jumps and voices coming in before they hit the delay and distortion
+	if (fx->compressor->active) {
+		Compressor_process(fx->compressor, out, frames);
+	}
+	if (fx->distortion->active) {
+		Distortion_update(fx->distortion);
+	}
+	for (unsigned int i = 0; i < frames; ++i) {
+		float sample = out[i];
+		if (fx->delay->active) {
+			sample = Delay_apply(fx->delay, sample);
+		}
+		if (fx->distortion->active) {
+			sample = Distortion_apply(fx->distortion, sample);
+		}
+		out[i] = sample;
+	}
+	// the taps' echoes join after the distortion, the main echo goes through it
+	if (fx->delay->active && fx->delay->numTaps > 0) {
+		Delay_processTaps(fx->delay, out, NULL, frames);
+	}
+	if (fx->doppler->active) {
+		Doppler_process(fx->doppler, out, frames);
+	}
+	if (fx->freqShift->active) {
+		FreqShift_process(fx->freqShift, out, frames);
+	}
+	if (fx->chorus->active) {
+		Chorus_process(fx->chorus, out, frames);
+	}
+	if (fx->flanger->active) {
+		Flanger_process(fx->flanger, out, frames);
+	}
+	if (fx->filter->active) {
+		Filter_process(fx->filter, out, frames);
+	}
+	// before the reverb, so the loop sits in the same room as the live playing
+	if (fx->looper != NULL && fx->looper->active) {
+		Looper_process(fx->looper, out, frames);
+	}
+	if (fx->reverb->active) {
+		Reverb_process(fx->reverb, out, frames);
+	}
+	// last, so nothing after it can go over again
+	if (fx->limiter->active) {
+		Limiter_process(fx->limiter, out, frames);
+	}
+}
+
+// touch every buffer the effects own so the callback never page-faults on them,
+// except the looper's, whose slots are locked and faulted in when it is made
+void Effects_prefault(Effects* fx) {
+	prefaultMemory(fx->delay->buffer, sizeof(StoredSample) * fx->delay->buffSize);
+	for (unsigned int i = 0; i < fx->harmonizer->numVoices; ++i) {
+		PShift* pshift = fx->harmonizer->shifters[i];
+		prefaultMemory(pshift->delay1->buffer, sizeof(StoredSample) * pshift->delay1->buffSize);
+		prefaultMemory(pshift->delay2->buffer, sizeof(StoredSample) * pshift->delay2->buffSize);
+	}
+	prefaultMemory(fx->harmonizer->mix, sizeof(float) * HARM_BLOCK);
+	for (int g = 0; g < fx->harmonizer->numGroups; ++g) {
+		prefaultMemory(fx->harmonizer->groupOuts[g], sizeof(float) * HARM_BLOCK);
+	}
+	if (fx->harmonizer->pipeIn != NULL) {
+		prefaultMemory(fx->harmonizer->pipeIn, sizeof(float) * HARM_BLOCK);
+	}
+	prefaultMemory(fx->chorus->delay->buffer, sizeof(StoredSample) * fx->chorus->delay->buffSize);
+	prefaultMemory(fx->flanger->delay->buffer, sizeof(StoredSample) * fx->flanger->delay->buffSize);
+	prefaultMemory(fx->doppler->delay->buffer, sizeof(StoredSample) * fx->doppler->delay->buffSize);
+	for (unsigned int i = 0; i < REVERB_LINES; ++i) {
+		prefaultMemory(fx->reverb->lines[i], sizeof(float) * fx->reverb->lengths[i]);
+	}
+	prefaultMemory(fx->limiter->delay, sizeof(float) * fx->limiter->lookahead);
+	prefaultMemory(fx->limiter->gains, sizeof(float) * fx->limiter->lookahead);
+	prefaultMemory(fx->limiter->peaks, sizeof(float) * (fx->limiter->dequeMask + 1));
+	prefaultMemory(fx->limiter->peakTimes, sizeof(uint32_t) * (fx->limiter->dequeMask + 1));
+}
@@ -0,0 +1,378 @@
+/*
+ * ENGINE
+ * Runs an independent effect chain for each input channel, so one box can
+ * serve a stage of performers on a multichannel interface. Every chain has its
+ * own effects, and with them its own parameters, its own pitch tracker and its
+ * own load figures. Chain i plays on output channel i modulo the number of
+ * outputs, summed with whatever other chains land there.
+ * With workers started, each callback deals the chains out to the audio
+ * thread and the workers as double-ended queues. Everyone takes chains from
+ * the front of their own queue and, once it's empty, steals from the back of
+ * the others', so a heavy chain on one core doesn't hold the rest up, and a
+ * worker that wakes late only finds its chains already taken. Between blocks
+ * the workers sleep on a semaphore instead of polling, so the cores they share
+ * with the sensor and pitch threads are only theirs while chains are running.
+ */
+#define MAX_CHAINS (8)
+
+typedef struct {
+	Effects* fx;
+	// NULL if the chain doesn't follow its input's pitch
+	PitchTracker* pitch;
+	int outChannel;
+	// the chain's own channel of the current block
+	float* in;
+	float* out;
+
+	// stats since the last report, added to by whichever thread ran the chain and
+	// taken with an exchange by the reporting thread, like the Realtime ones.
+	// load in millionths of the period
+	_Atomic long blocks;
+	_Atomic int64_t loadSum;
+	_Atomic int64_t maxLoad;
+}
+Chain;
+
+// the chain owns fx and pitch from here on
+Chain* Chain_create(Effects* fx, PitchTracker* pitch, int outChannel, int maxFrames) {
+	Chain* chain = (Chain*)malloc(sizeof(Chain));
+	chain->fx = fx;
+	chain->pitch = pitch;
+	chain->outChannel = outChannel;
+	chain->in = (float*)calloc(maxFrames, sizeof(float));
+	chain->out = (float*)calloc(maxFrames, sizeof(float));
+	atomic_init(&chain->blocks, 0);
+	atomic_init(&chain->loadSum, 0);
+	atomic_init(&chain->maxLoad, 0);
+	return chain;
+}
+
+// period is the time the block has to be done in, for the load figures
+static void Chain_process(Chain* chain, const float* in, float* out, unsigned long frames, double period) {
+	double start = nowSeconds();
+	if (chain->pitch != NULL) {
+		PitchTracker_push(chain->pitch, in, frames);
+		// the tracker's answer is from a hop or so ago, close enough to pick harmonies by
+		Harmonizer_setInputPitch(chain->fx->harmonizer, PitchTracker_getFrequency(chain->pitch));
+	}
+	Effects_process(chain->fx, in, out, frames);
+	int64_t load = (nowSeconds() - start) / period * 1e6;
+	atomic_fetch_add_explicit(&chain->loadSum, load, memory_order_relaxed);
+	Realtime_raise(&chain->maxLoad, load);
+	atomic_fetch_add_explicit(&chain->blocks, 1, memory_order_relaxed);
+}
+
+// prints the stats since the last report and starts them again
+void Chain_report(Chain* chain, int index) {
+	long blocks = atomic_exchange_explicit(&chain->blocks, 0, memory_order_relaxed);
+	int64_t loadSum = atomic_exchange_explicit(&chain->loadSum, 0, memory_order_relaxed);
+	int64_t maxLoad = atomic_exchange_explicit(&chain->maxLoad, 0, memory_order_relaxed);
+	printf("chain %d: load avg %.0f%% max %.0f%%", index,
+		   blocks > 0 ? loadSum * 1e-4 / blocks : 0, maxLoad * 1e-4);
+	if (chain->pitch != NULL) {
+		printf(", input pitch %.1f Hz, confidence %.2f", PitchTracker_getFrequency(chain->pitch),
+			   PitchTracker_getConfidence(chain->pitch));
+	}
+	printf("\n");
+}
+
+void Chain_destroy(Chain* chain) {
+	Effects_destroy(chain->fx);
+	if (chain->pitch != NULL) {
+		PitchTracker_destroy(chain->pitch);
+	}
+	free(chain->in);
+	free(chain->out);
+	free(chain);
+}
+
+typedef struct Engine Engine;
+
+typedef struct {
+	Engine* engine;
+	// queue index, the audio thread is 0
+	int index;
+	// posted once a block, and to stop
+	sem_t wake;
+}
+EngineWorker;
+
+struct Engine {
+	int inChannels;
+	int outChannels;
+	int sampleRate;
+	int maxFrames;
+	double period;
+
+	int numChains;
+	Chain* chains[MAX_CHAINS];
+	// the first output channel on its own, for the recorder, when there's more than one
+	float* monitor;
+
+	int numWorkers;
+	pthread_t* workers;
+	EngineWorker* workerArgs;
+	// each queue holds generation << 32 | head << 16 | tail, where queue p starts
+	// out as chains first[p] up to first[p + 1]
+	_Atomic uint64_t queues[MAX_CHAINS];
+	int first[MAX_CHAINS + 1];
+	_Atomic uint32_t generation;
+	_Atomic int finished;
+	_Atomic bool running;
+	unsigned long blockFrames;
+};
+
+// blocks can be up to maxFrames long, which the backends never go over
+Engine* Engine_create(int _inChannels, int _outChannels, int _maxFrames, int _sampleRate, int chunkSize) {
+	Engine* engine = (Engine*)malloc(sizeof(Engine));
+	engine->inChannels = _inChannels;
+	engine->outChannels = _outChannels;
+	engine->maxFrames = _maxFrames;
+	engine->sampleRate = _sampleRate;
+	engine->period = (double)chunkSize / engine->sampleRate;
+	engine->numChains = 0;
+	engine->monitor = (float*)calloc(engine->maxFrames, sizeof(float));
+	engine->numWorkers = 0;
+	engine->workers = NULL;
+	engine->workerArgs = NULL;
+	for (int p = 0; p < MAX_CHAINS; ++p) {
+		atomic_init(&engine->queues[p], 0);
+	}
+	atomic_init(&engine->generation, 0);
+	atomic_init(&engine->finished, 0);
+	atomic_init(&engine->running, false);
+	engine->blockFrames = 0;
+	return engine;
+}
+
+// returns the chain's index, or -1 when there's no room; add them all before starting workers
+int Engine_addChain(Engine* engine, Effects* fx, PitchTracker* pitch) {
+	if (engine->numChains >= MAX_CHAINS) {
+		return -1;
+	}
+	int index = engine->numChains++;
+	engine->chains[index] = Chain_create(fx, pitch, index % engine->outChannels, engine->maxFrames);
+	return index;
+}
+
+// takes a chain off the front or the back of a queue, -1 if it's empty or from another block
+static int Engine_take(Engine* engine, int queue, uint32_t generation, bool front) {
+	uint64_t word = atomic_load_explicit(&engine->queues[queue], memory_order_acquire);
+	while ((uint32_t)(word >> 32) == generation) {
+		int head = (word >> 16) & 0xffff;
+		int tail = word & 0xffff;
+		if (head >= tail) {
+			return -1;
+		}
+		uint64_t next = front ? word + (1 << 16) : word - 1;
+		if (atomic_compare_exchange_weak_explicit(&engine->queues[queue], &word, next,
+												  memory_order_acquire, memory_order_acquire)) {
+			return front ? head : tail - 1;
+		}
+	}
+	return -1;
+}
+
+// runs chains from our own queue, then from everyone else's, until there are none left
+static void Engine_work(Engine* engine, int queue, uint32_t generation) {
+	int numQueues = engine->numWorkers + 1;
+	while (true) {
+		int index = Engine_take(engine, queue, generation, true);
+		for (int q = 1; index < 0 && q < numQueues; ++q) {
+			index = Engine_take(engine, (queue + q) % numQueues, generation, false);
+		}
+		if (index < 0) {
+			return;
+		}
+		Chain* chain = engine->chains[index];
+		Chain_process(chain, chain->in, chain->out, engine->blockFrames, engine->period);
+		atomic_fetch_add_explicit(&engine->finished, 1, memory_order_release);
+	}
+}
+
+static void* Engine_worker(void* _worker) {
+	EngineWorker* worker = (EngineWorker*)_worker;
+	Engine* engine = worker->engine;
+	uint32_t seen = atomic_load(&engine->generation);
+	while (true) {
+		// posts pile up if we fall behind, the generation tells us if there's anything new
+		sem_wait(&worker->wake);
+		if (!atomic_load_explicit(&engine->running, memory_order_relaxed)) {
+			break;
+		}
+		uint32_t generation = atomic_load_explicit(&engine->generation, memory_order_acquire);
+		if (generation != seen) {
+			seen = generation;
+			Engine_work(engine, worker->index, generation);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Shares the chains with numWorkers threads, at most one fewer than there are
+ * chains. The threads are plain ones, pin them through engine->workers.
+ * Returns 0, or -1 if they didn't start and the audio thread runs every chain.
+ */
+int Engine_startWorkers(Engine* engine, int numWorkers) {
+	if (engine->numWorkers > 0) {
+		return -1;
+	}
+	if (numWorkers > engine->numChains - 1) {
+		numWorkers = engine->numChains - 1;
+	}
+	if (numWorkers < 1) {
+		return -1;
+	}
+	int numQueues = numWorkers + 1;
+	for (int p = 0; p <= numQueues; ++p) {
+		engine->first[p] = p * engine->numChains / numQueues;
+	}
+	atomic_store(&engine->running, true);
+	engine->workers = (pthread_t*)malloc(sizeof(pthread_t) * numWorkers);
+	engine->workerArgs = (EngineWorker*)malloc(sizeof(EngineWorker) * numWorkers);
+	// the queues are only dealt once there are workers to deal them to
+	engine->numWorkers = numWorkers;
+	for (int w = 0; w < numWorkers; ++w) {
+		engine->workerArgs[w].engine = engine;
+		engine->workerArgs[w].index = w + 1;
+		sem_init(&engine->workerArgs[w].wake, 0, 0);
+	}
+	for (int w = 0; w < numWorkers; ++w) {
+		if (pthread_create(&engine->workers[w], NULL, Engine_worker, &engine->workerArgs[w]) != 0) {
+			atomic_store(&engine->running, false);
+			for (int j = 0; j < w; ++j) {
+				sem_post(&engine->workerArgs[j].wake);
+				pthread_join(engine->workers[j], NULL);
+			}
+			for (int j = 0; j < numWorkers; ++j) {
+				sem_destroy(&engine->workerArgs[j].wake);
+			}
+			free(engine->workers);
+			free(engine->workerArgs);
+			engine->workers = NULL;
+			engine->workerArgs = NULL;
+			engine->numWorkers = 0;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void Engine_stopWorkers(Engine* engine) {
+	if (engine->numWorkers == 0) {
+		return;
+	}
+	atomic_store(&engine->running, false);
+	for (int w = 0; w < engine->numWorkers; ++w) {
+		sem_post(&engine->workerArgs[w].wake);
+		pthread_join(engine->workers[w], NULL);
+		sem_destroy(&engine->workerArgs[w].wake);
+	}
+	free(engine->workers);
+	free(engine->workerArgs);
+	engine->workers = NULL;
+	engine->workerArgs = NULL;
+	engine->numWorkers = 0;
+}
+
+// deals this block's chains out and runs our share, returns once all of them are done
+static void Engine_runChains(Engine* engine) {
+	if (engine->numWorkers == 0) {
+		for (int c = 0; c < engine->numChains; ++c) {
+			Chain* chain = engine->chains[c];
+			Chain_process(chain, chain->in, chain->out, engine->blockFrames, engine->period);
+		}
+		return;
+	}
+	uint32_t generation = atomic_load_explicit(&engine->generation, memory_order_relaxed) + 1;
+	atomic_store_explicit(&engine->finished, 0, memory_order_relaxed);
+	for (int p = 0; p <= engine->numWorkers; ++p) {
+		uint64_t word = (uint64_t)generation << 32 | (uint64_t)engine->first[p] << 16 | engine->first[p + 1];
+		atomic_store_explicit(&engine->queues[p], word, memory_order_relaxed);
+	}
+	atomic_store_explicit(&engine->generation, generation, memory_order_release);
+	// only a syscall for the workers that are actually asleep
+	for (int w = 0; w < engine->numWorkers; ++w) {
+		sem_post(&engine->workerArgs[w].wake);
+	}
+	Engine_work(engine, 0, generation);
+	while (atomic_load_explicit(&engine->finished, memory_order_acquire) < engine->numChains) {
+	}
+}
+
+// interleaved in and out, in the engine's channel counts
+void Engine_process(Engine* engine, const float* in, float* out, unsigned long frames) {
+	if (frames > (unsigned long)engine->maxFrames) {
+		memset(out, 0, sizeof(float) * frames * engine->outChannels);
+		return;
+	}
+	// one performer on a mono interface needs no copying at all
+	if (engine->numChains == 1 && engine->inChannels == 1 && engine->outChannels == 1) {
+		Chain_process(engine->chains[0], in, out, frames, engine->period);
+		return;
+	}
+	for (int c = 0; c < engine->numChains; ++c) {
+		float* chainIn = engine->chains[c]->in;
+		int inChannel = c % engine->inChannels;
+		for (unsigned long i = 0; i < frames; ++i) {
+			chainIn[i] = in[i * engine->inChannels + inChannel];
+		}
+	}
+	engine->blockFrames = frames;
+	Engine_runChains(engine);
+	memset(out, 0, sizeof(float) * frames * engine->outChannels);
+	for (int c = 0; c < engine->numChains; ++c) {
+		const float* chainOut = engine->chains[c]->out;
+		int outChannel = engine->chains[c]->outChannel;
+		for (unsigned long i = 0; i < frames; ++i) {
+			out[i * engine->outChannels + outChannel] += chainOut[i];
+		}
+	}
+	if (engine->outChannels > 1) {
+		for (unsigned long i = 0; i < frames; ++i) {
+			engine->monitor[i] = out[i * engine->outChannels];
+		}
+	}
+}
+
+// what a recorder should take from the block just processed
+const float* Engine_getMonitor(Engine* engine, const float* out) {
+	return engine->outChannels > 1 ? engine->monitor : out;
+}
+
+// the load figures are against this, and the delays line their crossfades up with it
+void Engine_setChunkSize(Engine* engine, int chunkSize) {
+	engine->period = (double)chunkSize / engine->sampleRate;
+	for (int c = 0; c < engine->numChains; ++c) {
+		Delay_setChunkSize(engine->chains[c]->fx->delay, chunkSize);
+	}
+}
+
+void Engine_report(Engine* engine) {
+	for (int c = 0; c < engine->numChains; ++c) {
+		Chain_report(engine->chains[c], c);
+	}
+}
+
+void Engine_prefault(Engine* engine) {
+	prefaultMemory(engine->monitor, sizeof(float) * engine->maxFrames);
+	for (int c = 0; c < engine->numChains; ++c) {
+		Chain* chain = engine->chains[c];
+		Effects_prefault(chain->fx);
+		if (chain->pitch != NULL) {
+			PitchTracker_prefault(chain->pitch);
+		}
+		prefaultMemory(chain->in, sizeof(float) * engine->maxFrames);
+		prefaultMemory(chain->out, sizeof(float) * engine->maxFrames);
+	}
+}
+
+void Engine_destroy(Engine* engine) {
+	Engine_stopWorkers(engine);
+	for (int c = 0; c < engine->numChains; ++c) {
+		Chain_destroy(engine->chains[c]);
+	}
+	free(engine->monitor);
+	free(engine);
+}
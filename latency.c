@@ -0,0 +1,235 @@
+/*
+ * ROUND TRIP LATENCY TOOL
+ * Plays a maximum length sequence out of the stream and records the input,
+ * which should be looped back to the output with a cable or snd-aloop.
+ * Cross-correlating the recording against the sequence finds where it came back,
+ * which is the real input-to-output latency including everything the drivers add.
+ *
+ * usage: latency [chunk sizes...]
+ *        latency --alsa <capture pcm> <playback pcm> [chunk sizes...]  (with -DUSE_ALSA_MMAP)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "portaudio.h"
+#include "pa_linux_alsa.h"
+#ifdef USE_ALSA_MMAP
+#include <alsa/asoundlib.h>
+#endif
+#include "math.h"
+#include "time.h"
+
+#include "lutmath.c"
+#include "utility.c"
+#include "realtime.c"
+#include "effects.c"
+#include "tuner.c"
+#ifdef USE_ALSA_MMAP
+#include "alsa_backend.c"
+#endif
+
+#define SAMPLE_RATE (44100)
+#define MLS_ORDER (14)
+#define MLS_AMPLITUDE (0.5f)
+// let the stream settle before the sequence goes out
+#define EMIT_AT (SAMPLE_RATE / 4)
+// longest round trip we look for
+#define MAX_LAG (SAMPLE_RATE / 2)
+#define CAPTURE_LENGTH (EMIT_AT + MAX_LAG + (1 << MLS_ORDER))
+
+typedef struct {
+	float* mls;
+	int mlsLength;
+	float* capture;
+	int frame;
+	volatile bool done;
+}
+LatencyTest;
+
+// +/-1 sequence from a maximal length LFSR, its autocorrelation is a single spike
+static void generateMls(float* mls, int order) {
+	// taps for x^14 + x^5 + x^3 + x + 1, a primitive polynomial
+	unsigned int taps = (1u << 13) | (1u << 4) | (1u << 2) | 1u;
+	unsigned int state = 1;
+	int length = (1 << order) - 1;
+	for (int i = 0; i < length; ++i) {
+		mls[i] = (state & 1) ? MLS_AMPLITUDE : -MLS_AMPLITUDE;
+		unsigned int feedback = __builtin_parity(state & taps);
+		state = (state >> 1) | (feedback << (order - 1));
+	}
+}
+
+static void LatencyTest_reset(LatencyTest* test) {
+	memset(test->capture, 0, sizeof(float) * CAPTURE_LENGTH);
+	test->frame = 0;
+	test->done = false;
+}
+
+static void latencyProcess(void* _test, const float* in, float* out, unsigned long frames) {
+	LatencyTest* test = (LatencyTest*)_test;
+	for (unsigned int i = 0; i < frames; ++i) {
+		int frame = test->frame + i;
+		// read before writing, in and out can be the same buffer
+		float sample = in[i];
+		if (frame < CAPTURE_LENGTH) {
+			test->capture[frame] = sample;
+		}
+		int mlsIndex = frame - EMIT_AT;
+		out[i] = (mlsIndex >= 0 && mlsIndex < test->mlsLength) ? test->mls[mlsIndex] : 0;
+	}
+	test->frame += frames;
+	if (test->frame >= CAPTURE_LENGTH) {
+		test->done = true;
+	}
+}
+
+static int latencyCallback(const void* inputBuffer, void* outputBuffer,
+						   unsigned long framesPerBuffer,
+						   const PaStreamCallbackTimeInfo* timeInfo,
+						   PaStreamCallbackFlags statusFlags,
+						   void* _test) {
+	latencyProcess(_test, (const float*)inputBuffer, (float*)outputBuffer, framesPerBuffer);
+	return ((LatencyTest*)_test)->done ? paComplete : paContinue;
+}
+
+// returns the lag in samples, and how far the peak stands above the average as confidence
+static int findLag(LatencyTest* test, float* confidence) {
+	float best = 0;
+	float total = 0;
+	int bestLag = -1;
+	for (int lag = 0; lag < MAX_LAG; ++lag) {
+		const float* x = test->capture + EMIT_AT + lag;
+		float sum = 0;
+		for (int k = 0; k < test->mlsLength; ++k) {
+			sum += x[k] * test->mls[k];
+		}
+		sum = fabsf(sum);
+		total += sum;
+		if (sum > best) {
+			best = sum;
+			bestLag = lag;
+		}
+	}
+	*confidence = total > 0 ? best / (total / MAX_LAG) : 0;
+	return bestLag;
+}
+
+static void report(const char* backend, int chunkSize, LatencyTest* test) {
+	float confidence;
+	int lag = findLag(test, &confidence);
+	// a real loopback spike is hundreds of times the background, noise is a few times
+	if (lag < 0 || confidence < 10) {
+		printf("%-10s %5d  no loopback signal found\n", backend, chunkSize);
+		return;
+	}
+	printf("%-10s %5d  %7.2f ms  %6d samples  (peak %.0fx average)\n",
+		   backend, chunkSize, lag * 1000.0f / SAMPLE_RATE, lag, confidence);
+}
+
+static bool runPortAudio(LatencyTest* test, int chunkSize) {
+	PaStream* stream;
+	LatencyTest_reset(test);
+	if (openAudioStream(&stream, 1, 1, SAMPLE_RATE, chunkSize, 0,
+						latencyCallback, test) != paNoError) {
+		return false;
+	}
+	if (Pa_StartStream(stream) != paNoError) {
+		Pa_CloseStream(stream);
+		return false;
+	}
+	while (!test->done) {
+		Pa_Sleep(50);
+	}
+	Pa_StopStream(stream);
+	Pa_CloseStream(stream);
+	return true;
+}
+
+#ifdef USE_ALSA_MMAP
+static bool runAlsa(LatencyTest* test, int chunkSize, const char* capture, const char* playback) {
+	LatencyTest_reset(test);
+	AlsaBackend* alsa = AlsaBackend_create(capture, playback, SAMPLE_RATE, chunkSize, 1, 1,
+										   latencyProcess, test, NULL);
+	if (alsa == NULL) {
+		return false;
+	}
+	if (AlsaBackend_start(alsa) != 0) {
+		AlsaBackend_destroy(alsa);
+		return false;
+	}
+	while (!test->done) {
+		usleep(50000);
+	}
+	AlsaBackend_destroy(alsa);
+	return true;
+}
+#endif
+
+int main(int argc, char** argv) {
+	static const int defaultChunkSizes[] = {32, 64, 128, 256};
+	int chunkSizes[16];
+	int numChunkSizes = 0;
+	const char* alsaCapture = NULL;
+	const char* alsaPlayback = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--alsa") == 0 && i + 2 < argc) {
+			alsaCapture = argv[++i];
+			alsaPlayback = argv[++i];
+		}
+		else if (numChunkSizes < 16 && atoi(argv[i]) > 0) {
+			chunkSizes[numChunkSizes++] = atoi(argv[i]);
+		}
+	}
+	if (numChunkSizes == 0) {
+		numChunkSizes = sizeof(defaultChunkSizes) / sizeof(defaultChunkSizes[0]);
+		memcpy(chunkSizes, defaultChunkSizes, sizeof(defaultChunkSizes));
+	}
+
+	LatencyTest test;
+	test.mlsLength = (1 << MLS_ORDER) - 1;
+	test.mls = (float*)malloc(sizeof(float) * test.mlsLength);
+	test.capture = (float*)malloc(sizeof(float) * CAPTURE_LENGTH);
+	generateMls(test.mls, MLS_ORDER);
+
+	Pa_Initialize();
+	printf("backend    chunk  round trip\n");
+	for (int i = 0; i < numChunkSizes; ++i) {
+		if (alsaCapture == NULL) {
+			if (runPortAudio(&test, chunkSizes[i])) {
+				report("portaudio", chunkSizes[i], &test);
+			}
+			else {
+				printf("%-10s %5d  could not open stream\n", "portaudio", chunkSizes[i]);
+			}
+			continue;
+		}
+#ifdef USE_ALSA_MMAP
+		if (runAlsa(&test, chunkSizes[i], alsaCapture, alsaPlayback)) {
+			report("alsa mmap", chunkSizes[i], &test);
+		}
+		else {
+			printf("%-10s %5d  could not open %s / %s\n", "alsa mmap", chunkSizes[i],
+				   alsaCapture, alsaPlayback);
+		}
+#else
+		fprintf(stderr, "built without USE_ALSA_MMAP, can't use %s / %s\n",
+				alsaCapture, alsaPlayback);
+		break;
+#endif
+	}
+	Pa_Terminate();
+	free(test.mls);
+	free(test.capture);
+	return 0;
+}
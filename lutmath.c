@@ -0,0 +1,119 @@
+/*
+ * LOOKUP TABLE MATH
+ * Interpolated tables for the transcendental functions we call at runtime,
+ * so neither the audio nor the sensor thread waits on libm. Each table is
+ * built once by LutMath_init, before any thread that uses it starts.
+ * exp2 and log2 split the float into exponent and mantissa and only table
+ * the mantissa, which keeps them accurate to about 1e-5 relative over the
+ * whole float range; everything else in the exp/log/pow family is built on them.
+ */
+#define EXP2_TABLE_BITS (8)
+#define EXP2_TABLE_SIZE (1 << EXP2_TABLE_BITS)
+#define LOG2_TABLE_BITS (8)
+#define LOG2_TABLE_SIZE (1 << LOG2_TABLE_BITS)
+#define SIN_TABLE_BITS (10)
+#define SIN_TABLE_SIZE (1 << SIN_TABLE_BITS)
+// tanh is within 1e-6 of +/-1 past here
+#define TANH_RANGE (8.0f)
+#define TANH_TABLE_SIZE (1024)
+
+// every table has one extra point so interpolation never runs off the end
+static float exp2Table[EXP2_TABLE_SIZE + 1];
+static float log2Table[LOG2_TABLE_SIZE + 1];
+static float sinTable[SIN_TABLE_SIZE + 1];
+static float tanhTable[TANH_TABLE_SIZE + 1];
+static bool lutMathReady = false;
+
+typedef union {
+	float value;
+	uint32_t bits;
+}
+FloatBits;
+
+void LutMath_init() {
+	if (lutMathReady) {
+		return;
+	}
+	for (int i = 0; i <= EXP2_TABLE_SIZE; ++i) {
+		exp2Table[i] = exp2((double)i / EXP2_TABLE_SIZE);
+	}
+	for (int i = 0; i <= LOG2_TABLE_SIZE; ++i) {
+		log2Table[i] = log2(1 + (double)i / LOG2_TABLE_SIZE);
+	}
+	for (int i = 0; i <= SIN_TABLE_SIZE; ++i) {
+		sinTable[i] = sin(2 * M_PI * i / SIN_TABLE_SIZE);
+	}
+	for (int i = 0; i <= TANH_TABLE_SIZE; ++i) {
+		tanhTable[i] = tanh(TANH_RANGE * (2.0 * i / TANH_TABLE_SIZE - 1));
+	}
+	lutMathReady = true;
+}
+
+static inline float lutExp2(float x) {
+	// past these the result isn't a normal float any more
+	if (x < -126) {
+		return 0;
+	}
+	if (x > 127.99f) {
+		x = 127.99f;
+	}
+	int whole = (int)x;
+	if (x < whole) {
+		--whole;
+	}
+	float position = (x - whole) * EXP2_TABLE_SIZE;
+	int index = (int)position;
+	float mantissa = exp2Table[index] + (exp2Table[index + 1] - exp2Table[index]) * (position - index);
+	FloatBits scale;
+	scale.bits = (uint32_t)(whole + 127) << 23;
+	return mantissa * scale.value;
+}
+
+// x has to be positive, there's no NaN or -inf handling
+static inline float lutLog2(float x) {
+	FloatBits in;
+	in.value = x;
+	int exponent = (int)((in.bits >> 23) & 0xff) - 127;
+	uint32_t mantissa = in.bits & 0x7fffff;
+	int index = mantissa >> (23 - LOG2_TABLE_BITS);
+	float frac = (mantissa & ((1 << (23 - LOG2_TABLE_BITS)) - 1)) *
+				 (1.0f / (1 << (23 - LOG2_TABLE_BITS)));
+	return exponent + log2Table[index] + (log2Table[index + 1] - log2Table[index]) * frac;
+}
+
+static inline float lutExp(float x) {
+	return lutExp2(x * (float)M_LOG2E);
+}
+
+static inline float lutLog(float x) {
+	return lutLog2(x) * (float)M_LN2;
+}
+
+// base has to be positive
+static inline float lutPow(float base, float exponent) {
+	return lutExp2(exponent * lutLog2(base));
+}
+
+// frequency ratio of an interval, 12 semitones is 2
+static inline float semitoneRatio(float semitones) {
+	return lutExp2(semitones * (1.0f / 12));
+}
+
+static inline float lutTanh(float x) {
+	if (x <= -TANH_RANGE) {
+		return -1;
+	}
+	if (x >= TANH_RANGE) {
+		return 1;
+	}
+	float position = (x + TANH_RANGE) * (TANH_TABLE_SIZE / (2 * TANH_RANGE));
+	int index = (int)position;
+	return tanhTable[index] + (tanhTable[index + 1] - tanhTable[index]) * (position - index);
+}
+
+// sine of a 32 bit phase, where 2^32 is a full cycle, so oscillators can just wrap
+static inline float lutSin(uint32_t phase) {
+	uint32_t index = phase >> (32 - SIN_TABLE_BITS);
+	float frac = (phase << SIN_TABLE_BITS) * (1.0f / 4294967296.0f);
+	return sinTable[index] + (sinTable[index + 1] - sinTable[index]) * frac;
+}
@@ -0,0 +1,335 @@
+/*
+ * PITCH TRACKER
+ * Finds the pitch of the input with YIN, so effects can follow what's being
+ * played. The audio thread only copies its input into a lock-free ring; every
+ * PITCH_HOP samples the newest two windows are analysed and the result is
+ * published as atomics that any thread can read. The analysis runs on a worker
+ * thread once PitchTracker_start is called, otherwise inline from
+ * PitchTracker_push, which is what the offline tools do.
+ * YIN's difference function is the sum of squares of x[j] - x[j + lag] over a
+ * window, for every lag. Expanded, that's two energy terms, which are running
+ * sums, minus twice a cross-correlation, which comes from one FFT of the two
+ * real sequences packed as a complex one and one inverse FFT, instead of the
+ * window * lags multiply-adds of computing it directly.
+ */
+// samples between analyses, about 12 ms at 44.1kHz
+#define PITCH_HOP (512)
+// YIN's absolute threshold on the normalised difference, lower is stricter
+#define PITCH_THRESHOLD (0.15f)
+// RMS below which the input counts as silence, about -60 dBFS
+#define PITCH_SILENCE (0.001f)
+// how long the worker sleeps when no new hop has arrived
+#define PITCH_IDLE_MICROS (2000)
+
+// radix 2 complex FFT on split real and imaginary arrays, in place
+typedef struct {
+	int size;
+	float* cosTable;
+	float* sinTable;
+	int* reverse;
+}
+Fft;
+
+Fft* Fft_create(int bits) {
+	Fft* fft = (Fft*)malloc(sizeof(Fft));
+	fft->size = 1 << bits;
+	fft->cosTable = (float*)malloc(sizeof(float) * fft->size / 2);
+	fft->sinTable = (float*)malloc(sizeof(float) * fft->size / 2);
+	fft->reverse = (int*)malloc(sizeof(int) * fft->size);
+	for (int i = 0; i < fft->size / 2; ++i) {
+		fft->cosTable[i] = cos(2 * M_PI * i / fft->size);
+		fft->sinTable[i] = -sin(2 * M_PI * i / fft->size);
+	}
+	for (int i = 0; i < fft->size; ++i) {
+		int r = 0;
+		for (int b = 0; b < bits; ++b) {
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		fft->reverse[i] = r;
+	}
+	return fft;
+}
+
+// forward transform; the inverse is this on the conjugate, conjugated and scaled
+void Fft_run(Fft* fft, float* re, float* im) {
+	int n = fft->size;
+	for (int i = 0; i < n; ++i) {
+		int r = fft->reverse[i];
+		if (r > i) {
+			float t = re[i];
+			re[i] = re[r];
+			re[r] = t;
+			t = im[i];
+			im[i] = im[r];
+			im[r] = t;
+		}
+	}
+	for (int half = 1; half < n; half <<= 1) {
+		int step = n / (half * 2);
+		for (int start = 0; start < n; start += half * 2) {
+			for (int k = 0; k < half; ++k) {
+				float wr = fft->cosTable[k * step];
+				float wi = fft->sinTable[k * step];
+				int a = start + k;
+				int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+void Fft_destroy(Fft* fft) {
+	free(fft->cosTable);
+	free(fft->sinTable);
+	free(fft->reverse);
+	free(fft);
+}
+
+typedef struct {
+	int sampleRate;
+	// the difference function is summed over window samples, for lags up to maxLag
+	int window;
+	int size;
+	int minLag;
+	int maxLag;
+
+	float* ring;
+	uint32_t ringMask;
+	// head is only written by the audio thread, analysed only by whoever analyses
+	_Atomic uint32_t head;
+	uint32_t analysed;
+
+	Fft* fft;
+	float* frame;
+	float* re;
+	float* im;
+	float* diff;
+
+	// in Hz, 0 when there's no clear pitch
+	_Atomic float frequency;
+	// 0 to 1, how periodic the last window was
+	_Atomic float confidence;
+
+	pthread_t thread;
+	_Atomic bool running;
+	bool threaded;
+}
+PitchTracker;
+
+// the range to look for pitches in, in Hz; the lowest sets the window length
+PitchTracker* PitchTracker_create(float minFreq, float maxFreq, int _sampleRate) {
+	PitchTracker* pt = (PitchTracker*)malloc(sizeof(PitchTracker));
+	pt->sampleRate = _sampleRate;
+	pt->minLag = pt->sampleRate / maxFreq;
+	if (pt->minLag < 2) {
+		pt->minLag = 2;
+	}
+	pt->maxLag = pt->sampleRate / minFreq + 1;
+	int bits = 1;
+	while ((1 << bits) <= pt->maxLag + 1) {
+		++bits;
+	}
+	pt->window = 1 << bits;
+	// the correlation runs over two windows, which never wrap around at this size
+	pt->size = pt->window * 2;
+	pt->fft = Fft_create(bits + 1);
+
+	// room for a few analyses' worth, so a late worker still reads whole frames
+	uint32_t ringSize = 1;
+	while (ringSize < (uint32_t)(pt->size + PITCH_HOP) * 4) {
+		ringSize <<= 1;
+	}
+	pt->ring = (float*)calloc(ringSize, sizeof(float));
+	pt->ringMask = ringSize - 1;
+	atomic_init(&pt->head, 0);
+	pt->analysed = 0;
+
+	pt->frame = (float*)malloc(sizeof(float) * pt->size);
+	pt->re = (float*)malloc(sizeof(float) * pt->size);
+	pt->im = (float*)malloc(sizeof(float) * pt->size);
+	pt->diff = (float*)malloc(sizeof(float) * (pt->maxLag + 2));
+	atomic_init(&pt->frequency, 0);
+	atomic_init(&pt->confidence, 0);
+	atomic_init(&pt->running, false);
+	pt->threaded = false;
+	return pt;
+}
+
+// r[lag] = sum over j < window of x[j] * x[j + lag], left in re
+static void PitchTracker_correlate(PitchTracker* pt) {
+	int n = pt->size;
+	float* x = pt->frame;
+	float* re = pt->re;
+	float* im = pt->im;
+	// the first window, zero padded, as the real part and all of it as the imaginary
+	for (int j = 0; j < n; ++j) {
+		re[j] = j < pt->window ? x[j] : 0;
+		im[j] = x[j];
+	}
+	Fft_run(pt->fft, re, im);
+	// split the two spectra apart and multiply one's conjugate by the other.
+	// k and n - k are done together since each needs the other's input
+	for (int k = 0; k <= n / 2; ++k) {
+		int nk = (n - k) & (n - 1);
+		float ar = (re[k] + re[nk]) * 0.5f;
+		float ai = (im[k] - im[nk]) * 0.5f;
+		float br = (im[k] + im[nk]) * 0.5f;
+		float bi = (re[nk] - re[k]) * 0.5f;
+		float cr = ar * br + ai * bi;
+		float ci = ar * bi - ai * br;
+		// conjugated for the inverse, and the result is hermitian
+		re[k] = cr;
+		im[k] = -ci;
+		re[nk] = cr;
+		im[nk] = ci;
+	}
+	Fft_run(pt->fft, re, im);
+	float scale = 1.0f / n;
+	for (int j = 0; j <= pt->maxLag + 1; ++j) {
+		re[j] *= scale;
+	}
+}
+
+// runs YIN on the frame and publishes what it finds
+static void PitchTracker_analyze(PitchTracker* pt) {
+	float* x = pt->frame;
+	int window = pt->window;
+	float energy = 0;
+	for (int j = 0; j < window; ++j) {
+		energy += x[j] * x[j];
+	}
+	if (energy < PITCH_SILENCE * PITCH_SILENCE * window) {
+		atomic_store_explicit(&pt->frequency, 0, memory_order_relaxed);
+		atomic_store_explicit(&pt->confidence, 0, memory_order_relaxed);
+		return;
+	}
+	PitchTracker_correlate(pt);
+	const float* r = pt->re;
+	float* diff = pt->diff;
+
+	// cumulative mean normalised difference, so lag 0's dip doesn't count
+	float shiftedEnergy = energy;
+	float runningSum = 0;
+	diff[0] = 1;
+	for (int lag = 1; lag <= pt->maxLag + 1 && lag < window; ++lag) {
+		shiftedEnergy += x[lag + window - 1] * x[lag + window - 1] - x[lag - 1] * x[lag - 1];
+		float d = energy + shiftedEnergy - 2 * r[lag];
+		d = d > 0 ? d : 0;
+		runningSum += d;
+		diff[lag] = runningSum > 0 ? d * lag / runningSum : 1;
+	}
+
+	// the first dip under the threshold, followed down to the bottom
+	int best = -1;
+	for (int lag = pt->minLag; lag <= pt->maxLag; ++lag) {
+		if (diff[lag] < PITCH_THRESHOLD) {
+			while (lag + 1 <= pt->maxLag && diff[lag + 1] < diff[lag]) {
+				++lag;
+			}
+			best = lag;
+			break;
+		}
+	}
+	if (best < 0) {
+		atomic_store_explicit(&pt->frequency, 0, memory_order_relaxed);
+		atomic_store_explicit(&pt->confidence, 0, memory_order_relaxed);
+		return;
+	}
+	// a parabola through the dip and its neighbours places it between samples
+	float lag = best;
+	float a = diff[best - 1];
+	float b = diff[best];
+	float c = diff[best + 1];
+	float curve = a - 2 * b + c;
+	if (curve > 0) {
+		lag += (a - c) / (2 * curve);
+	}
+	atomic_store_explicit(&pt->frequency, pt->sampleRate / lag, memory_order_relaxed);
+	atomic_store_explicit(&pt->confidence, 1 - b, memory_order_relaxed);
+}
+
+// analyses the newest frame if a hop has gone by since the last one
+static bool PitchTracker_update(PitchTracker* pt) {
+	uint32_t head = atomic_load_explicit(&pt->head, memory_order_acquire);
+	if (head - pt->analysed < PITCH_HOP) {
+		return false;
+	}
+	// if we fell behind, skip straight to the newest audio
+	pt->analysed = head;
+	uint32_t start = head - pt->size;
+	for (int j = 0; j < pt->size; ++j) {
+		pt->frame[j] = pt->ring[(start + j) & pt->ringMask];
+	}
+	PitchTracker_analyze(pt);
+	return true;
+}
+
+// called from the audio thread; without a worker this is where the analysis runs
+void PitchTracker_push(PitchTracker* pt, const float* samples, unsigned long frames) {
+	uint32_t head = atomic_load_explicit(&pt->head, memory_order_relaxed);
+	uint32_t index = head & pt->ringMask;
+	unsigned long first = pt->ringMask + 1 - index;
+	if (first > frames) {
+		first = frames;
+	}
+	memcpy(pt->ring + index, samples, first * sizeof(float));
+	memcpy(pt->ring, samples + first, (frames - first) * sizeof(float));
+	atomic_store_explicit(&pt->head, head + frames, memory_order_release);
+	if (!pt->threaded) {
+		PitchTracker_update(pt);
+	}
+}
+
+static void* PitchTracker_thread(void* _pt) {
+	PitchTracker* pt = (PitchTracker*)_pt;
+	while (atomic_load(&pt->running)) {
+		if (!PitchTracker_update(pt)) {
+			usleep(PITCH_IDLE_MICROS);
+		}
+	}
+	return NULL;
+}
+
+// moves the analysis off the audio thread
+int PitchTracker_start(PitchTracker* pt) {
+	atomic_store(&pt->running, true);
+	pt->threaded = true;
+	if (pthread_create(&pt->thread, NULL, PitchTracker_thread, pt) != 0) {
+		atomic_store(&pt->running, false);
+		pt->threaded = false;
+		return -1;
+	}
+	return 0;
+}
+
+float PitchTracker_getFrequency(PitchTracker* pt) {
+	return atomic_load_explicit(&pt->frequency, memory_order_relaxed);
+}
+
+float PitchTracker_getConfidence(PitchTracker* pt) {
+	return atomic_load_explicit(&pt->confidence, memory_order_relaxed);
+}
+
+// the audio thread writes the ring, so have it mapped in before audio starts
+void PitchTracker_prefault(PitchTracker* pt) {
+	prefaultMemory(pt->ring, sizeof(float) * (pt->ringMask + 1));
+}
+
+void PitchTracker_destroy(PitchTracker* pt) {
+	if (atomic_load(&pt->running)) {
+		atomic_store(&pt->running, false);
+		pthread_join(pt->thread, NULL);
+	}
+	Fft_destroy(pt->fft);
+	free(pt->ring);
+	free(pt->frame);
+	free(pt->re);
+	free(pt->im);
+	free(pt->diff);
+	free(pt);
+}
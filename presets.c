@@ -0,0 +1,115 @@
+/*
+ * PRESETS
+ * Named effect settings for the offline tools, and a chain built to match one.
+ * The batch renderer and the regression harness both render through these,
+ * so a preset name means the same sound in both.
+ */
+// the same block size the live engine runs at by default
+#define RENDER_CHUNK (128)
+#define MAX_VOICES (12)
+// the live setup's voices, always built so presets with fewer fade the rest out like it does
+#define LIVE_VOICES (4)
+
+// everything a preset can change, an effect is off when its amount is 0
+typedef struct {
+	const char* name;
+	float gain;
+	int voices;
+	float distortion;
+	float shape;
+	float delaySeconds;
+	float feedback;
+	// extra delay taps, spread evenly inside the delay time
+	int taps;
+	float cutoff;
+	float decay;
+	float chorusMix;
+	float flangerMix;
+	float freqShift;
+	// output limiter ceiling
+	float limit;
+	// compressor threshold in dB
+	float compress;
+}
+Preset;
+
+// harmony voices in the order the live setup brings them in
+static const int presetShifts[MAX_VOICES] = {7, 12, 4, 9, -12, 16, 19, -5, 24, 2, -8, 14};
+
+static const Preset presets[] = {
+	// name        gain voices dist  shape      delay fdbk  taps cutoff decay chorus flanger shift  limit compress
+	{"clean",      1,   0,     0,    DIST_SOFT, 0,    0,    0,    0,     0,    0,     0,      0,     0,    0},
+	{"harmony2",   1,   2,     0,    DIST_SOFT, 0,    0,    0,    0,     0,    0,     0,      0,     0,    0},
+	{"harmony4",   1,   4,     0,    DIST_SOFT, 0,    0,    0,    0,     0,    0,     0,      0,     0,    0},
+	{"distort",    1,   0,     0.6f, DIST_SOFT, 0,    0,    0,    0,     0,    0,     0,      0,     0,    0},
+	{"fold",       1,   0,     0.6f, DIST_FOLD, 0,    0,    0,    0,     0,    0,     0,      0,     0,    0},
+	{"filter",     1,   0,     0,    DIST_SOFT, 0,    0,    0,    1500,  0,    0,     0,      0,     0,    0},
+	{"reverb",     1,   0,     0,    DIST_SOFT, 0,    0,    0,    0,     3,    0,     0,      0,     0,    0},
+	{"chorus",     1,   0,     0,    DIST_SOFT, 0,    0,    0,    0,     0,    0.5f,  0,      0,     0,    0},
+	{"flanger",    1,   0,     0,    DIST_SOFT, 0,    0,    0,    0,     0,    0,     0.5f,   0,     0,    0},
+	{"freqshift",  1,   0,     0,    DIST_SOFT, 0,    0,    0,    0,     0,    0,     0,      100,   0,    0},
+	{"delay",      1,   0,     0,    DIST_SOFT, 0.35f,0.5f, 0,    0,     0,    0,     0,      0,     0,    0},
+	{"taps",       1,   0,     0,    DIST_SOFT, 0.6f, 0.3f, 3,    0,     0,    0,     0,      0,     0,    0},
+	{"ambient",    1,   0,     0,    DIST_SOFT, 0.5f, 0.4f, 0,    6000,  4,    0.5f,  0,      0,     0,    0},
+	{"metal",      1,   0,     0.4f, DIST_TUBE, 0,    0,    0,    0,     1,    0,     0.5f,   100,   0,    0},
+	{"limited",    1,   4,     0,    DIST_SOFT, 0.35f,0.7f, 2,    0,     0,    0,     0,      0,     0.9f, 0},
+	{"compressed", 1,   4,     0.3f, DIST_SOFT, 0,    0,    0,    0,     0,    0,     0,      0,     0,    -24},
+	{"choir12",    1,   12,    0,    DIST_SOFT, 0,    0,    0,    0,     0,    0,     0,      0,     0,    0},
+	{"full",       1,   4,     0.5f, DIST_SOFT, 0.35f,0.5f, 0,    4000,  2,    0.5f,  0,      0,     0,    0},
+};
+#define NUM_PRESETS ((int)(sizeof(presets) / sizeof(presets[0])))
+
+static const Preset* findPreset(const char* name) {
+	for (int i = 0; i < NUM_PRESETS; ++i) {
+		if (strcmp(presets[i].name, name) == 0) {
+			return &presets[i];
+		}
+	}
+	return NULL;
+}
+
+// a full chain with only what the preset asks for switched on
+static Effects* buildEffects(const Preset* preset, int sampleRate) {
+	Gain* gain = Gain_create(preset->gain);
+	Distortion* dist = Distortion_create(preset->distortion);
+	Distortion_setShape(dist, preset->shape);
+	dist->active = preset->distortion > 0;
+	Delay* del = Delay_create(preset->delaySeconds * sampleRate, preset->feedback,
+							  sampleRate, RENDER_CHUNK);
+	// each tap a bit quieter than the one before, alternating sides
+	for (int t = 0; t < preset->taps; ++t) {
+		float position = (t + 1.0f) / (preset->taps + 1);
+		Delay_addTap(del, preset->delaySeconds * position * sampleRate, 0.8f - 0.6f * position,
+					 t % 2 == 0 ? -0.7f : 0.7f);
+	}
+	del->active = preset->delaySeconds > 0;
+	int numVoices = preset->voices > LIVE_VOICES ? preset->voices : LIVE_VOICES;
+	// quieter each the more there are, so a choir sits at about the level of four
+	float mixAmounts[MAX_VOICES];
+	for (int v = 0; v < numVoices; ++v) {
+		mixAmounts[v] = 0.9f * LIVE_VOICES / numVoices;
+	}
+	Harmonizer* harm = Harmonizer_create(numVoices, (int*)presetShifts, mixAmounts, sampleRate);
+	Harmonizer_setActiveVoices(harm, preset->voices);
+	harm->active = preset->voices > 0;
+	Filter* filter = Filter_create(2, preset->cutoff > 0 ? preset->cutoff : 1000, sampleRate);
+	filter->active = preset->cutoff > 0;
+	Reverb* reverb = Reverb_create(preset->decay > 0 ? preset->decay : 1, 0.3f, 0.25f, sampleRate);
+	reverb->active = preset->decay > 0;
+	Chorus* chorus = Chorus_create(3, 15, 3, 0.8f, preset->chorusMix, sampleRate);
+	chorus->active = preset->chorusMix > 0;
+	Flanger* flanger = Flanger_create(1, 1, 0.25f, 0.6f, preset->flangerMix, sampleRate);
+	flanger->active = preset->flangerMix > 0;
+	Doppler* doppler = Doppler_create(1500, sampleRate);
+	// nothing is moving offline
+	doppler->active = false;
+	FreqShift* freqShift = FreqShift_create(preset->freqShift, 1, sampleRate);
+	freqShift->active = preset->freqShift != 0;
+	// float WAVs can't clip, so it's only on where a preset wants to hear it
+	Limiter* limiter = Limiter_create(preset->limit > 0 ? preset->limit : 1, 0.0015f, 0.1f, sampleRate);
+	limiter->active = preset->limit > 0;
+	Compressor* comp = Compressor_create(ENV_RMS, preset->compress, 4, 0.005f, 0.15f, 0, sampleRate);
+	comp->active = preset->compress < 0;
+	return Effects_create(gain, dist, del, harm, filter, reverb, chorus, flanger, doppler,
+						  freqShift, NULL, limiter, comp);
+}
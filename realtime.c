@@ -0,0 +1,215 @@
+/*
+ * REALTIME SETUP
+ * Keeps the audio callback and the sensor loop off each other's toes.
+ * Locks and pre-faults memory so the callback never takes a page fault,
+ * pins threads to their own cores with SCHED_FIFO priorities,
+ * and measures how regularly the callback actually gets called.
+ */
+#define AUDIO_CORE (3)
+#define SENSOR_CORE (2)
+#define AUDIO_PRIORITY (70)
+#define SENSOR_PRIORITY (30)
+// analysis workers get their own core, below both
+#define PITCH_CORE (1)
+#define PITCH_PRIORITY (20)
+// harmonizer voice workers go on the cores the audio thread isn't on, above the
+// threads there so a claimed group is never stuck behind a sensor read. they
+// sleep until the audio thread hands out a block, which leaves those threads the
+// core in between, and the audio thread runs whatever groups they wake up too late for
+#define HARM_CORES {0, 1, 2}
+#define HARM_PRIORITY (60)
+// with several input channels the chains share the same cores, but their workers
+// sleep until the audio thread hands out a block, so between blocks the sensor
+// and pitch threads have their cores to themselves
+#define ENGINE_CORES {0, 1, 2}
+#define ENGINE_PRIORITY (60)
+// how much stack to touch up front so deep calls don't fault later
+#define PREFAULT_STACK_BYTES (256 * 1024)
+
+typedef struct {
+	int audioCore;
+	int audioPriority;
+	int sensorCore;
+	int sensorPriority;
+	// expected time between callbacks, in seconds
+	double period;
+
+	bool audioPinned;
+	double lastCallback;
+	double callbackStart;
+
+	// stats since the last report. the audio thread adds to them and the reporting
+	// thread takes them with an exchange, so nothing counted in between gets lost.
+	// times in nanoseconds, load in millionths of the period
+	_Atomic long callbacks;
+	_Atomic int64_t jitterSum;
+	_Atomic int64_t maxJitter;
+	_Atomic int64_t maxLoad;
+	_Atomic long xruns;
+}
+Realtime;
+
+double nowSeconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void prefaultMemory(void* mem, size_t bytes) {
+	// write to every page so the kernel maps it in now rather than mid-callback
+	long pageSize = sysconf(_SC_PAGESIZE);
+	volatile char* bytePtr = (volatile char*)mem;
+	for (size_t i = 0; i < bytes; i += pageSize) {
+		bytePtr[i] = bytePtr[i];
+	}
+	if (bytes > 0) {
+		bytePtr[bytes - 1] = bytePtr[bytes - 1];
+	}
+}
+
+static void prefaultStack() {
+	volatile char stack[PREFAULT_STACK_BYTES];
+	prefaultMemory((void*)stack, sizeof(stack));
+}
+
+Realtime* Realtime_create(int _audioCore, int _audioPriority,
+						  int _sensorCore, int _sensorPriority,
+						  int sampleRate, int chunkSize) {
+	Realtime* rt = (Realtime*)malloc(sizeof(Realtime));
+	rt->audioCore = _audioCore;
+	rt->audioPriority = _audioPriority;
+	rt->sensorCore = _sensorCore;
+	rt->sensorPriority = _sensorPriority;
+	rt->period = (double)chunkSize / sampleRate;
+
+	rt->audioPinned = false;
+	rt->lastCallback = 0;
+	rt->callbackStart = 0;
+	atomic_init(&rt->callbacks, 0);
+	atomic_init(&rt->jitterSum, 0);
+	atomic_init(&rt->maxJitter, 0);
+	atomic_init(&rt->maxLoad, 0);
+	atomic_init(&rt->xruns, 0);
+	return rt;
+}
+
+// only call while no stream is running, e.g. between calibration runs
+void Realtime_restart(Realtime* rt, int sampleRate, int chunkSize) {
+	rt->period = (double)chunkSize / sampleRate;
+	// a new stream means a new callback thread that needs pinning again
+	rt->audioPinned = false;
+	rt->lastCallback = 0;
+	atomic_store(&rt->callbacks, 0);
+	atomic_store(&rt->jitterSum, 0);
+	atomic_store(&rt->maxJitter, 0);
+	atomic_store(&rt->maxLoad, 0);
+	atomic_store(&rt->xruns, 0);
+}
+
+int Realtime_lockMemory() {
+	// keep freed memory in the heap and never hand out fresh mmap'd chunks,
+	// so nothing we touch later has to be faulted in or given back
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	// everything, code and libraries included, now and from here on. anything
+	// that mustn't be pinned whole, like the looper's file, has to opt out itself
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		perror("mlockall");
+		return -1;
+	}
+	prefaultStack();
+	return 0;
+}
+
+int Realtime_pinThread(pthread_t thread, int core, int priority) {
+	int result = 0;
+	if (core >= 0 && core < sysconf(_SC_NPROCESSORS_ONLN)) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(core, &cpus);
+		if (pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus) != 0) {
+			fprintf(stderr, "could not pin thread to core %d\n", core);
+			result = -1;
+		}
+	}
+	struct sched_param param;
+	param.sched_priority = priority;
+	if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0) {
+		fprintf(stderr, "could not set SCHED_FIFO priority %d\n", priority);
+		result = -1;
+	}
+	return result;
+}
+
+// the sensor loop runs on the main thread
+int Realtime_pinSensorThread(Realtime* rt) {
+	return Realtime_pinThread(pthread_self(), rt->sensorCore, rt->sensorPriority);
+}
+
+// raises a stat to value if it's higher; only the reporting thread's exchange can get in between
+static void Realtime_raise(_Atomic int64_t* stat, int64_t value) {
+	int64_t old = atomic_load_explicit(stat, memory_order_relaxed);
+	while (value > old && !atomic_compare_exchange_weak_explicit(stat, &old, value, memory_order_relaxed,
+																  memory_order_relaxed)) {
+	}
+}
+
+// call at the top of the audio callback
+void Realtime_callbackStart(Realtime* rt) {
+	// PortAudio owns the callback thread, so we can only grab it from inside
+	if (!rt->audioPinned) {
+		Realtime_pinThread(pthread_self(), rt->audioCore, rt->audioPriority);
+		prefaultStack();
+		rt->audioPinned = true;
+	}
+	rt->callbackStart = nowSeconds();
+	if (rt->lastCallback != 0) {
+		int64_t jitter = fabs(rt->callbackStart - rt->lastCallback - rt->period) * 1e9;
+		atomic_fetch_add_explicit(&rt->jitterSum, jitter, memory_order_relaxed);
+		Realtime_raise(&rt->maxJitter, jitter);
+		atomic_fetch_add_explicit(&rt->callbacks, 1, memory_order_relaxed);
+	}
+	rt->lastCallback = rt->callbackStart;
+}
+
+// call from the callback when PortAudio flags an under/overflow
+void Realtime_xrun(Realtime* rt) {
+	atomic_fetch_add_explicit(&rt->xruns, 1, memory_order_relaxed);
+}
+
+// call at the bottom of the audio callback
+void Realtime_callbackEnd(Realtime* rt) {
+	double load = (nowSeconds() - rt->callbackStart) / rt->period;
+	Realtime_raise(&rt->maxLoad, load * 1e6);
+}
+
+// these two are for after a run, when nothing is adding to them
+long Realtime_getXruns(Realtime* rt) {
+	return atomic_load(&rt->xruns);
+}
+
+double Realtime_getMaxLoad(Realtime* rt) {
+	return atomic_load(&rt->maxLoad) * 1e-6;
+}
+
+// prints the stats since the last report and starts them again
+void Realtime_report(Realtime* rt) {
+	if (atomic_load_explicit(&rt->callbacks, memory_order_relaxed) == 0) {
+		return;
+	}
+	long callbacks = atomic_exchange_explicit(&rt->callbacks, 0, memory_order_relaxed);
+	long xruns = atomic_exchange_explicit(&rt->xruns, 0, memory_order_relaxed);
+	int64_t jitterSum = atomic_exchange_explicit(&rt->jitterSum, 0, memory_order_relaxed);
+	int64_t maxJitter = atomic_exchange_explicit(&rt->maxJitter, 0, memory_order_relaxed);
+	int64_t maxLoad = atomic_exchange_explicit(&rt->maxLoad, 0, memory_order_relaxed);
+	printf("callbacks: %ld, xruns: %ld, jitter avg %.1f us, max %.1f us, max load %.0f%%\n",
+		   callbacks,
+		   xruns,
+		   jitterSum * 1e-3 / callbacks,
+		   maxJitter * 1e-3,
+		   maxLoad * 1e-4);
+}
+
+void Realtime_destroy(Realtime* rt) {
+	free(rt);
+}
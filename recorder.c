@@ -0,0 +1,241 @@
+/*
+ * RECORDER
+ * Taps the final output into a preallocated lock-free ring. The audio thread
+ * only copies samples in and moves an index, it never allocates, locks or
+ * touches the disk. If the ring is full the block is dropped and counted.
+ * A normal-priority writer thread drains the ring to a float WAV (or raw)
+ * file in large sequential writes, optionally with O_DIRECT and a
+ * preallocated file so the filesystem does as little as possible mid-show.
+ */
+// must be a power of two, about 6 s at 44.1kHz
+#define RECORD_RING_SAMPLES (1 << 18)
+// samples per disk write, a multiple of any sane O_DIRECT block size
+#define RECORD_WRITE_SAMPLES (1 << 16)
+#define RECORD_ALIGN (4096)
+// how long the writer sleeps when there's nothing to write
+#define RECORD_IDLE_MICROS (20000)
+
+#define RECORD_RAW (1 << 0)
+#define RECORD_DIRECT (1 << 1)
+#define RECORD_PREALLOCATE (1 << 2)
+
+typedef struct {
+	const char* path;
+	int sampleRate;
+	int flags;
+	off_t preallocBytes;
+
+	float* ring;
+	// head is only written by the audio thread, tail only by the writer
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	_Atomic long dropped;
+
+	int fd;
+	// aligned staging block that is handed to write() whole
+	unsigned char* staging;
+	size_t stagingFill;
+	uint64_t dataBytes;
+
+	pthread_t thread;
+	_Atomic bool running;
+}
+Recorder;
+
+// writes out the staging block, padding the last one when O_DIRECT needs it
+static bool Recorder_flush(Recorder* rec, bool last) {
+	if (rec->stagingFill == 0) {
+		return true;
+	}
+	size_t bytes = rec->stagingFill;
+	if (last && (rec->flags & RECORD_DIRECT)) {
+		bytes = (bytes + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+		memset(rec->staging + rec->stagingFill, 0, bytes - rec->stagingFill);
+	}
+	size_t done = 0;
+	while (done < bytes) {
+		ssize_t written = write(rec->fd, rec->staging + done, bytes - done);
+		if (written < 0) {
+			perror("recorder write");
+			return false;
+		}
+		done += written;
+	}
+	rec->stagingFill = 0;
+	return true;
+}
+
+// moves everything currently in the ring into the file
+static bool Recorder_drain(Recorder* rec) {
+	size_t stagingSize = RECORD_WRITE_SAMPLES * sizeof(float);
+	uint32_t tail = atomic_load_explicit(&rec->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&rec->head, memory_order_acquire);
+	while (tail != head) {
+		uint32_t index = tail & (RECORD_RING_SAMPLES - 1);
+		size_t samples = head - tail;
+		// don't run off the end of the ring or the staging block
+		if (samples > RECORD_RING_SAMPLES - index) {
+			samples = RECORD_RING_SAMPLES - index;
+		}
+		size_t space = (stagingSize - rec->stagingFill) / sizeof(float);
+		if (samples > space) {
+			samples = space;
+		}
+		memcpy(rec->staging + rec->stagingFill, rec->ring + index, samples * sizeof(float));
+		rec->stagingFill += samples * sizeof(float);
+		rec->dataBytes += samples * sizeof(float);
+		tail += samples;
+		atomic_store_explicit(&rec->tail, tail, memory_order_release);
+		if (rec->stagingFill == stagingSize && !Recorder_flush(rec, false)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void* Recorder_thread(void* _rec) {
+	Recorder* rec = (Recorder*)_rec;
+	while (atomic_load(&rec->running)) {
+		uint32_t before = atomic_load(&rec->tail);
+		if (!Recorder_drain(rec)) {
+			break;
+		}
+		// only sleep if we didn't just have to catch up
+		if (atomic_load(&rec->tail) - before < RECORD_WRITE_SAMPLES) {
+			usleep(RECORD_IDLE_MICROS);
+		}
+	}
+	Recorder_drain(rec);
+	Recorder_flush(rec, true);
+	return NULL;
+}
+
+// preallocSeconds is how much file to reserve up front with RECORD_PREALLOCATE
+Recorder* Recorder_create(const char* _path, int _sampleRate, int _flags, float preallocSeconds) {
+	Recorder* rec = (Recorder*)malloc(sizeof(Recorder));
+	rec->path = _path;
+	rec->sampleRate = _sampleRate;
+	rec->flags = _flags;
+	rec->preallocBytes = (off_t)(preallocSeconds * rec->sampleRate) * sizeof(float);
+
+	int openFlags = O_WRONLY | O_CREAT | O_TRUNC;
+	if (rec->flags & RECORD_DIRECT) {
+		openFlags |= O_DIRECT;
+	}
+	rec->fd = open(rec->path, openFlags, 0644);
+	if (rec->fd < 0 && (rec->flags & RECORD_DIRECT)) {
+		// not every filesystem does O_DIRECT, fall back to the page cache
+		fprintf(stderr, "%s: no O_DIRECT, writing through the page cache\n", rec->path);
+		rec->flags &= ~RECORD_DIRECT;
+		rec->fd = open(rec->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (rec->fd < 0) {
+		perror(rec->path);
+		free(rec);
+		return NULL;
+	}
+	if ((rec->flags & RECORD_PREALLOCATE) && rec->preallocBytes > 0) {
+		// returns the error rather than setting errno; without the space the
+		// recording still works, the filesystem just allocates as it goes
+		int err = posix_fallocate(rec->fd, 0, rec->preallocBytes);
+		if (err != 0) {
+			fprintf(stderr, "%s: couldn't preallocate (%s), allocating as it records\n",
+					rec->path, strerror(err));
+		}
+	}
+
+	rec->ring = (float*)malloc(sizeof(float) * RECORD_RING_SAMPLES);
+	memset(rec->ring, 0, sizeof(float) * RECORD_RING_SAMPLES);
+	if (posix_memalign((void**)&rec->staging, RECORD_ALIGN,
+					   RECORD_WRITE_SAMPLES * sizeof(float) + RECORD_ALIGN) != 0) {
+		close(rec->fd);
+		free(rec->ring);
+		free(rec);
+		return NULL;
+	}
+	atomic_init(&rec->head, 0);
+	atomic_init(&rec->tail, 0);
+	atomic_init(&rec->dropped, 0);
+	atomic_init(&rec->running, false);
+	rec->dataBytes = 0;
+	rec->stagingFill = 0;
+	// reserve room for the header, it gets filled in once we know the length
+	if (!(rec->flags & RECORD_RAW)) {
+		memset(rec->staging, 0, WAV_HEADER_BYTES);
+		rec->stagingFill = WAV_HEADER_BYTES;
+	}
+	return rec;
+}
+
+int Recorder_start(Recorder* rec) {
+	atomic_store(&rec->running, true);
+	if (pthread_create(&rec->thread, NULL, Recorder_thread, rec) != 0) {
+		atomic_store(&rec->running, false);
+		return -1;
+	}
+	return 0;
+}
+
+// called from the audio thread, never blocks
+void Recorder_push(Recorder* rec, const float* samples, unsigned long frames) {
+	uint32_t head = atomic_load_explicit(&rec->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&rec->tail, memory_order_acquire);
+	if (RECORD_RING_SAMPLES - (head - tail) < frames) {
+		atomic_fetch_add_explicit(&rec->dropped, frames, memory_order_relaxed);
+		return;
+	}
+	uint32_t index = head & (RECORD_RING_SAMPLES - 1);
+	unsigned long first = RECORD_RING_SAMPLES - index;
+	if (first > frames) {
+		first = frames;
+	}
+	memcpy(rec->ring + index, samples, first * sizeof(float));
+	memcpy(rec->ring, samples + first, (frames - first) * sizeof(float));
+	atomic_store_explicit(&rec->head, head + frames, memory_order_release);
+}
+
+long Recorder_getDropped(Recorder* rec) {
+	return atomic_load(&rec->dropped);
+}
+
+// stops the writer, trims the file and fills in the header
+void Recorder_stop(Recorder* rec) {
+	if (!atomic_load(&rec->running)) {
+		return;
+	}
+	atomic_store(&rec->running, false);
+	pthread_join(rec->thread, NULL);
+
+	off_t length = rec->dataBytes + ((rec->flags & RECORD_RAW) ? 0 : WAV_HEADER_BYTES);
+	// drops the O_DIRECT padding and any unused preallocation
+	if (ftruncate(rec->fd, length) != 0) {
+		perror("recorder truncate");
+	}
+	close(rec->fd);
+	rec->fd = -1;
+	if (!(rec->flags & RECORD_RAW)) {
+		// the header is too small for O_DIRECT, so patch it through a normal descriptor
+		int fd = open(rec->path, O_WRONLY);
+		if (fd >= 0) {
+			unsigned char header[WAV_HEADER_BYTES];
+			wavHeader(header, rec->sampleRate, 1, WAV_FORMAT_FLOAT, rec->dataBytes);
+			if (pwrite(fd, header, WAV_HEADER_BYTES, 0) != WAV_HEADER_BYTES) {
+				perror("recorder header");
+			}
+			close(fd);
+		}
+	}
+	if (Recorder_getDropped(rec) > 0) {
+		fprintf(stderr, "recorder dropped %ld samples\n", Recorder_getDropped(rec));
+	}
+}
+
+void Recorder_destroy(Recorder* rec) {
+	Recorder_stop(rec);
+	if (rec->fd >= 0) {
+		close(rec->fd);
+	}
+	free(rec->ring);
+	free(rec->staging);
+	free(rec);
+}
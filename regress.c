@@ -0,0 +1,636 @@
+/*
+ * REGRESSION HARNESS
+ * Renders a fixed input through every preset and checks the result against
+ * golden WAVs, so an optimization that changes the sound fails here rather
+ * than on stage. A render passes if its SNR against the golden is at least
+ * MIN_SNR_DB and no sample is off by more than MAX_ERROR. Each render is also
+ * timed, best of TIMING_RUNS, and must not be more than the slack slower than
+ * the time recorded when the goldens were last updated. Timings only mean
+ * something on the machine that recorded them, so update them on the Pi.
+ * --math checks the lookup table math against libm instead, for accuracy
+ * and for how long each call takes next to the libm one. --storage measures
+ * the sample storage the build uses (-DSTORE_INT16, -DSTORE_FLOAT16 or float):
+ * round trip error at a few levels, and the speed of a delay with more history
+ * than the Pi's cache. Compact storage builds can't match float goldens bit
+ * for bit, so check them with a lower --snr. --pitch runs the pitch tracker on
+ * test tones, for its error in cents and the time one analysis takes next to
+ * working the difference function out directly. --workers runs the harmonizer
+ * voices on that many fork/join worker threads, which only reorders the sum of
+ * the voices, so the goldens still hold and the timings show what they buy.
+ * --chains renders the presets n at a time as the chains of one engine, each
+ * on its own input and output channel and spread over n - 1 workers, and
+ * checks every channel against its golden. --limiter checks the limiter's
+ * sliding window peak against a direct search of the window, at lookaheads one
+ * short of a power of 2 where the window exactly fills the deque.
+ *
+ * A preset with no recorded time fails, so record them on the Pi with --update
+ * and check with --no-timing anywhere else.
+ *
+ * usage: regress [--update] [--no-timing] [--slack percent] [--snr dB] [--workers n] [preset...]
+ *        regress --chains n [--snr dB] [preset...]
+ *        regress --math | --storage | --pitch | --limiter
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "math.h"
+#include "time.h"
+
+#include "lutmath.c"
+#include "realtime.c"
+#include "pitch.c"
+#include "effects.c"
+#include "engine.c"
+#include "wav.c"
+#include "presets.c"
+
+#define REGRESS_INPUT "soundfiles/original.wav"
+#define GOLDEN_DIR "soundfiles/golden"
+#define TIMING_FILE GOLDEN_DIR "/timing.txt"
+#define PATH_LENGTH (1024)
+
+// 16 bit audio is about 96 dB, anything this far down is rounding
+#define MIN_SNR_DB (80.0)
+#define MAX_ERROR (1e-3f)
+#define TIMING_RUNS (5)
+// how much slower than its recorded time a render can get, in percent
+#define TIMING_SLACK (20.0)
+
+// reads a whole file, returns the number of samples or 0 if it couldn't
+static unsigned long loadWav(const char* path, float** samples, int* sampleRate) {
+	WavReader* reader = WavReader_open(path);
+	if (reader == NULL) {
+		return 0;
+	}
+	unsigned long length = reader->framesLeft;
+	*samples = (float*)malloc(sizeof(float) * (length + RENDER_CHUNK));
+	length = WavReader_read(reader, *samples, length);
+	*sampleRate = reader->sampleRate;
+	WavReader_close(reader);
+	return length;
+}
+
+// harmonizer worker threads for every render, 0 for none
+static int harmWorkers = 0;
+
+// renders in live-sized blocks, returns the seconds spent in the chain
+static double render(const Preset* preset, const float* in, float* out,
+					 unsigned long length, int sampleRate) {
+	Effects* fx = buildEffects(preset, sampleRate);
+	if (harmWorkers > 0 && fx->harmonizer->active) {
+		Harmonizer_startWorkers(fx->harmonizer, harmWorkers, false);
+	}
+	float block[RENDER_CHUNK];
+	double start = nowSeconds();
+	for (unsigned long done = 0; done < length; done += RENDER_CHUNK) {
+		unsigned long frames = length - done < RENDER_CHUNK ? length - done : RENDER_CHUNK;
+		memcpy(block, in + done, frames * sizeof(float));
+		memset(block + frames, 0, (RENDER_CHUNK - frames) * sizeof(float));
+		Effects_process(fx, block, block, RENDER_CHUNK);
+		memcpy(out + done, block, frames * sizeof(float));
+	}
+	double seconds = nowSeconds() - start;
+	Effects_destroy(fx);
+	return seconds;
+}
+
+// signal to error ratio in dB, infinite when they match exactly
+static double snr(const float* golden, const float* out, unsigned long length, float* maxError) {
+	double signal = 0;
+	double noise = 0;
+	*maxError = 0;
+	for (unsigned long i = 0; i < length; ++i) {
+		float error = fabsf(out[i] - golden[i]);
+		signal += (double)golden[i] * golden[i];
+		noise += (double)error * error;
+		if (error > *maxError) {
+			*maxError = error;
+		}
+	}
+	if (noise == 0) {
+		return INFINITY;
+	}
+	return 10 * log10(signal / noise);
+}
+
+#define MATH_POINTS (100000)
+// a power of two, small enough to stay in cache so only the math gets timed
+#define BENCH_INPUTS (1024)
+#define BENCH_CALLS (4000000)
+
+static volatile float benchSink;
+
+// sweeps lutExpr against refExpr (both of x) over [lo, hi], then times both;
+// the error is relative when relative is true, fails past tolerance
+#define CHECK_MATH(name, lutExpr, refExpr, lo, hi, relative, tolerance) {\
+	double worst = 0;\
+	for (int i = 0; i < MATH_POINTS; ++i) {\
+		float x = lo + (hi - lo) * (double)i / MATH_POINTS;\
+		double want = (refExpr);\
+		double error = fabs((lutExpr) - want);\
+		if (relative && want != 0) {\
+			error /= fabs(want);\
+		}\
+		if (error > worst) {\
+			worst = error;\
+		}\
+	}\
+	float inputs[BENCH_INPUTS];\
+	for (int i = 0; i < BENCH_INPUTS; ++i) {\
+		inputs[i] = lo + (hi - lo) * (float)rand() / RAND_MAX;\
+	}\
+	float sum = 0;\
+	double start = nowSeconds();\
+	for (int i = 0; i < BENCH_CALLS; ++i) {\
+		float x = inputs[i & (BENCH_INPUTS - 1)];\
+		sum += (lutExpr);\
+	}\
+	double lutNanos = (nowSeconds() - start) * 1e9 / BENCH_CALLS;\
+	start = nowSeconds();\
+	for (int i = 0; i < BENCH_CALLS; ++i) {\
+		float x = inputs[i & (BENCH_INPUTS - 1)];\
+		sum += (refExpr);\
+	}\
+	double libmNanos = (nowSeconds() - start) * 1e9 / BENCH_CALLS;\
+	benchSink = sum;\
+	bool ok = worst <= tolerance;\
+	printf("%-10s %10.2e %10.2e %9.2f %9.2f  %s\n", name, worst, (double)tolerance,\
+		   lutNanos, libmNanos, ok ? "" : "ACCURACY");\
+	failed += !ok;\
+}
+
+static int checkMath() {
+	LutMath_init();
+	int failed = 0;
+	printf("%-10s %10s %10s %9s %9s\n", "function", "max error", "allowed", "lut ns", "libm ns");
+	CHECK_MATH("exp2", lutExp2(x), exp2f(x), -20.0f, 20.0f, true, 1e-5);
+	CHECK_MATH("log2", lutLog2(x), log2f(x), 1e-3f, 1e4f, false, 1e-5);
+	CHECK_MATH("exp", lutExp(x), expf(x), -10.0f, 10.0f, true, 2e-5);
+	CHECK_MATH("log", lutLog(x), logf(x), 1e-3f, 1e4f, false, 1e-5);
+	CHECK_MATH("pow", lutPow(x, 2.5f), powf(x, 2.5f), 0.01f, 100.0f, true, 1e-4);
+	CHECK_MATH("semitones", semitoneRatio(x), powf(2, x / 12), -24.0f, 24.0f, true, 1e-5);
+	CHECK_MATH("tanh", lutTanh(x), tanhf(x), -10.0f, 10.0f, false, 1e-4);
+	CHECK_MATH("sin", lutSin((uint32_t)(x * (float)(4294967296.0 / (2 * M_PI)))), sinf(x),
+			   0.0f, 6.28f, false, 1e-5);
+	if (failed > 0) {
+		printf("%d failed\n", failed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
+
+// the delay's history is bigger than the Pi 3's 512 KB L2, so its reads come from memory
+#define STORAGE_DELAY_SECONDS (3)
+#define STORAGE_RUN_SECONDS (20)
+
+static int checkStorage() {
+#if defined(STORE_INT16)
+	const char* name = "int16";
+#elif defined(STORE_FLOAT16)
+	const char* name = "float16";
+#else
+	const char* name = "float";
+#endif
+	const int sampleRate = 44100;
+	printf("storage %s, %d bytes per sample\n", name, (int)sizeof(StoredSample));
+	// a 997 Hz sine at a few levels, including past full scale
+	const float levels[] = {2.0f, 0.5f, 0.01f, 0.0001f};
+	for (int l = 0; l < 4; ++l) {
+		double signal = 0;
+		double noise = 0;
+		for (int i = 0; i < sampleRate; ++i) {
+			float x = levels[l] * sinf(2 * M_PI * 997 * i / sampleRate);
+			float error = fromStored(toStored(x)) - x;
+			signal += (double)x * x;
+			noise += (double)error * error;
+		}
+		printf("level %8.4f  round trip snr %6.1f dB\n", levels[l],
+			   noise > 0 ? 10 * log10(signal / noise) : INFINITY);
+	}
+
+	Delay* del = Delay_create(STORAGE_DELAY_SECONDS * sampleRate, 0.5f, sampleRate, RENDER_CHUNK);
+	Delay_addTap(del, sampleRate, 0.5f, 0);
+	Delay_addTap(del, 2 * sampleRate, 0.5f, 0);
+	float block[RENDER_CHUNK];
+	unsigned int seed = 1;
+	long samples = (long)STORAGE_RUN_SECONDS * sampleRate;
+	double start = nowSeconds();
+	for (long done = 0; done < samples; done += RENDER_CHUNK) {
+		for (int i = 0; i < RENDER_CHUNK; ++i) {
+			seed = seed * 1664525 + 1013904223;
+			block[i] = Delay_apply(del, (int32_t)seed * (0.1f / 2147483648.0f));
+		}
+		Delay_processTaps(del, block, NULL, RENDER_CHUNK);
+	}
+	double nanos = (nowSeconds() - start) * 1e9 / samples;
+	benchSink = block[0];
+	printf("%d s delay with 2 taps, %.1f MB of history: %.2f ns/sample\n",
+		   STORAGE_DELAY_SECONDS, del->buffSize * sizeof(StoredSample) / 1e6, nanos);
+	Delay_destroy(del);
+	return 0;
+}
+
+// lookaheads of 2^k - 1, so the window is exactly the deque's capacity
+static const int limiterLookaheads[] = {1, 3, 7, 63, 255, 1023};
+#define LIMITER_RUN_SAMPLES (20000)
+
+static int checkLimiter() {
+	const int sampleRate = 44100;
+	int failed = 0;
+	for (unsigned int l = 0; l < sizeof(limiterLookaheads) / sizeof(limiterLookaheads[0]); ++l) {
+		int lookahead = limiterLookaheads[l];
+		Limiter* lim = Limiter_create(0.5f, (lookahead + 0.5f) / sampleRate, 0.05f, sampleRate);
+		float* history = (float*)malloc(sizeof(float) * LIMITER_RUN_SAMPLES);
+		unsigned int seed = (unsigned int)lookahead;
+		int errors = 0;
+		for (int i = 0; i < LIMITER_RUN_SAMPLES; ++i) {
+			// a steady fall longer than any window fills the deque right up, noise empties it
+			seed = seed * 1664525 + 1013904223;
+			int phase = i % 4000;
+			history[i] = phase < 2100 ? 1 - phase / 4000.0f : (int32_t)seed * (0.5f / 2147483648.0f);
+			float sample = history[i];
+			Limiter_process(lim, &sample, 1);
+			float expected = 0;
+			for (int j = i - lookahead > 0 ? i - lookahead : 0; j <= i; ++j) {
+				expected = fmaxf(expected, fabsf(history[j]));
+			}
+			if (lim->peaks[lim->head & lim->dequeMask] != expected ||
+				lim->tail - lim->head > lim->dequeMask + 1) {
+				++errors;
+			}
+		}
+		printf("lookahead %5d  deque %5u  %d wrong peaks  %s\n", lookahead, lim->dequeMask + 1,
+			   errors, errors == 0 ? "" : "WRONG");
+		failed += errors > 0;
+		free(history);
+		Limiter_destroy(lim);
+	}
+	return failed;
+}
+
+// the live tracker's range, low E on a bass to the top of a voice
+#define PITCH_MIN_FREQ (40.0f)
+#define PITCH_MAX_FREQ (1500.0f)
+#define PITCH_MAX_CENTS (5.0)
+#define PITCH_RUNS (200)
+
+// what the FFT replaces: the difference function summed sample by sample
+static float directDifference(PitchTracker* pt) {
+	float* x = pt->frame;
+	float total = 0;
+	for (int lag = 1; lag <= pt->maxLag; ++lag) {
+		float sum = 0;
+		for (int j = 0; j < pt->window; ++j) {
+			float d = x[j] - x[j + lag];
+			sum += d * d;
+		}
+		total += sum;
+	}
+	return total;
+}
+
+static int checkPitch() {
+	const int sampleRate = 44100;
+	// bass, guitar and voice notes, as sines and with a stack of harmonics
+	const float notes[] = {41.2f, 82.41f, 110, 196, 261.63f, 440, 880, 1318.5f};
+	const int numNotes = sizeof(notes) / sizeof(notes[0]);
+	int failed = 0;
+	float tone[RENDER_CHUNK];
+	printf("%-8s %10s %10s %10s\n", "note Hz", "sine cents", "rich cents", "confidence");
+	for (int n = 0; n < numNotes; ++n) {
+		double cents[2];
+		float confidence = 0;
+		for (int rich = 0; rich < 2; ++rich) {
+			PitchTracker* pt = PitchTracker_create(PITCH_MIN_FREQ, PITCH_MAX_FREQ, sampleRate);
+			for (int done = 0; done < sampleRate / 2; done += RENDER_CHUNK) {
+				for (int i = 0; i < RENDER_CHUNK; ++i) {
+					double phase = 2 * M_PI * notes[n] * (done + i) / sampleRate;
+					tone[i] = 0.5f * sin(phase);
+					if (rich) {
+						// a weak fundamental under its harmonics, the usual way to fool a tracker
+						tone[i] = 0.2f * sin(phase) + 0.4f * sin(2 * phase) + 0.3f * sin(3 * phase) +
+								  0.2f * sin(4 * phase);
+					}
+				}
+				PitchTracker_push(pt, tone, RENDER_CHUNK);
+			}
+			float found = PitchTracker_getFrequency(pt);
+			cents[rich] = found > 0 ? 1200 * log2(found / notes[n]) : INFINITY;
+			confidence = PitchTracker_getConfidence(pt);
+			PitchTracker_destroy(pt);
+			if (!(fabs(cents[rich]) <= PITCH_MAX_CENTS)) {
+				++failed;
+			}
+		}
+		printf("%-8.2f %10.2f %10.2f %10.3f\n", notes[n], cents[0], cents[1], confidence);
+	}
+
+	PitchTracker* pt = PitchTracker_create(PITCH_MIN_FREQ, PITCH_MAX_FREQ, sampleRate);
+	for (int j = 0; j < pt->size; ++j) {
+		pt->frame[j] = sinf(2 * M_PI * 220 * j / sampleRate);
+	}
+	double start = nowSeconds();
+	for (int run = 0; run < PITCH_RUNS; ++run) {
+		PitchTracker_analyze(pt);
+	}
+	double fftMicros = (nowSeconds() - start) * 1e6 / PITCH_RUNS;
+	start = nowSeconds();
+	float sum = 0;
+	for (int run = 0; run < PITCH_RUNS / 20; ++run) {
+		sum += directDifference(pt);
+	}
+	double directMicros = (nowSeconds() - start) * 1e6 / (PITCH_RUNS / 20);
+	benchSink = sum;
+	printf("window %d, lags %d to %d: %.1f us per analysis, %.1f us for the direct "
+		   "difference alone, one hop is %.1f ms\n", pt->window, pt->minLag, pt->maxLag,
+		   fftMicros, directMicros, PITCH_HOP * 1000.0 / sampleRate);
+	PitchTracker_destroy(pt);
+	if (failed > 0) {
+		printf("%d off by more than %.0f cents\n", failed, PITCH_MAX_CENTS);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
+
+// renders a batch of presets side by side, one chain each, into outs
+static double renderChains(const Preset** batch, int numChains, const float* in, float** outs,
+						   unsigned long length, int sampleRate) {
+	Engine* engine = Engine_create(numChains, numChains, RENDER_CHUNK, sampleRate, RENDER_CHUNK);
+	for (int c = 0; c < numChains; ++c) {
+		Engine_addChain(engine, buildEffects(batch[c], sampleRate), NULL);
+	}
+	Engine_startWorkers(engine, numChains - 1);
+	float* blockIn = (float*)malloc(sizeof(float) * RENDER_CHUNK * numChains);
+	float* blockOut = (float*)malloc(sizeof(float) * RENDER_CHUNK * numChains);
+	double start = nowSeconds();
+	for (unsigned long done = 0; done < length; done += RENDER_CHUNK) {
+		unsigned long frames = length - done < RENDER_CHUNK ? length - done : RENDER_CHUNK;
+		for (unsigned long i = 0; i < RENDER_CHUNK; ++i) {
+			for (int c = 0; c < numChains; ++c) {
+				blockIn[i * numChains + c] = i < frames ? in[done + i] : 0;
+			}
+		}
+		Engine_process(engine, blockIn, blockOut, RENDER_CHUNK);
+		for (unsigned long i = 0; i < frames; ++i) {
+			for (int c = 0; c < numChains; ++c) {
+				outs[c][done + i] = blockOut[i * numChains + c];
+			}
+		}
+	}
+	double seconds = nowSeconds() - start;
+	free(blockIn);
+	free(blockOut);
+	Engine_destroy(engine);
+	return seconds;
+}
+
+static int checkChains(const Preset** chosen, int numChosen, int numChains, double minSnr) {
+	float* in;
+	int sampleRate;
+	unsigned long length = loadWav(REGRESS_INPUT, &in, &sampleRate);
+	if (length == 0) {
+		return 1;
+	}
+	float* outs[MAX_CHAINS];
+	for (int c = 0; c < numChains; ++c) {
+		outs[c] = (float*)malloc(sizeof(float) * length);
+	}
+	int failed = 0;
+	printf("%-10s %9s %10s %9s\n", "preset", "snr dB", "max error", "ns/samp");
+	for (int first = 0; first < numChosen; first += numChains) {
+		int batchSize = numChosen - first < numChains ? numChosen - first : numChains;
+		double seconds = renderChains(chosen + first, batchSize, in, outs, length, sampleRate);
+		for (int c = 0; c < batchSize; ++c) {
+			const Preset* preset = chosen[first + c];
+			char path[PATH_LENGTH];
+			snprintf(path, PATH_LENGTH, "%s/%s.wav", GOLDEN_DIR, preset->name);
+			float* golden;
+			int goldenRate;
+			unsigned long goldenLength = loadWav(path, &golden, &goldenRate);
+			if (goldenLength != length || goldenRate != sampleRate) {
+				printf("%-10s no usable golden at %s, run with --update\n", preset->name, path);
+				if (goldenLength > 0) {
+					free(golden);
+				}
+				++failed;
+				continue;
+			}
+			float maxError;
+			double ratio = snr(golden, outs[c], length, &maxError);
+			free(golden);
+			bool accurate = ratio >= minSnr && maxError <= MAX_ERROR;
+			// the whole batch's time, it's the engine that's being timed
+			printf("%-10s %9.1f %10.2e %9.2f  %s\n", preset->name, ratio, maxError,
+				   seconds * 1e9 / length, accurate ? "" : "ACCURACY");
+			if (!accurate) {
+				++failed;
+			}
+		}
+	}
+	for (int c = 0; c < numChains; ++c) {
+		free(outs[c]);
+	}
+	free(in);
+	if (failed > 0) {
+		printf("%d of %d failed\n", failed, numChosen);
+		return 1;
+	}
+	printf("all %d passed\n", numChosen);
+	return 0;
+}
+
+// looks up a preset's recorded time in ns per sample, 0 if there isn't one
+static double loadTiming(const char* name) {
+	FILE* file = fopen(TIMING_FILE, "r");
+	if (file == NULL) {
+		return 0;
+	}
+	char presetName[64];
+	double nanos;
+	double found = 0;
+	while (fscanf(file, "%63s %lf", presetName, &nanos) == 2) {
+		if (strcmp(presetName, name) == 0) {
+			found = nanos;
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+int main(int argc, char** argv) {
+	bool update = false;
+	bool timing = true;
+	double slack = TIMING_SLACK;
+	double minSnr = MIN_SNR_DB;
+	const Preset* chosen[NUM_PRESETS];
+	int numChosen = 0;
+	int numChains = 0;
+	// before --chains starts any workers
+	LutMath_init();
+	Distortion_initTables();
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--update") == 0) {
+			update = true;
+		}
+		else if (strcmp(argv[i], "--math") == 0) {
+			return checkMath();
+		}
+		else if (strcmp(argv[i], "--storage") == 0) {
+			return checkStorage();
+		}
+		else if (strcmp(argv[i], "--pitch") == 0) {
+			return checkPitch();
+		}
+		else if (strcmp(argv[i], "--limiter") == 0) {
+			return checkLimiter();
+		}
+		else if (strcmp(argv[i], "--snr") == 0 && i + 1 < argc) {
+			minSnr = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--chains") == 0 && i + 1 < argc) {
+			numChains = atoi(argv[++i]);
+			if (numChains < 1 || numChains > MAX_CHAINS) {
+				fprintf(stderr, "--chains takes 1 to %d\n", MAX_CHAINS);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			harmWorkers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-timing") == 0) {
+			timing = false;
+		}
+		else if (strcmp(argv[i], "--slack") == 0 && i + 1 < argc) {
+			slack = atof(argv[++i]);
+		}
+		else if (findPreset(argv[i]) != NULL && numChosen < NUM_PRESETS) {
+			chosen[numChosen++] = findPreset(argv[i]);
+		}
+		else {
+			fprintf(stderr, "usage: regress [--update] [--no-timing] [--slack percent] [--snr dB] "
+					"[--workers n] [preset...]\n"
+					"       regress --chains n [--snr dB] [preset...]\n"
+					"       regress --math | --storage | --pitch | --limiter\n");
+			return 1;
+		}
+	}
+	if (numChosen == 0) {
+		for (int p = 0; p < NUM_PRESETS; ++p) {
+			chosen[numChosen++] = &presets[p];
+		}
+	}
+	if (numChains > 0) {
+		return checkChains(chosen, numChosen, numChains, minSnr);
+	}
+
+	float* in;
+	int sampleRate;
+	unsigned long length = loadWav(REGRESS_INPUT, &in, &sampleRate);
+	if (length == 0) {
+		return 1;
+	}
+	float* out = (float*)malloc(sizeof(float) * length);
+	FILE* timingFile = NULL;
+	if (update) {
+		mkdir(GOLDEN_DIR, 0755);
+		timingFile = fopen(TIMING_FILE, "w");
+	}
+
+	int failed = 0;
+	bool missingTiming = false;
+	printf("%-10s %9s %10s %9s %9s\n", "preset", "snr dB", "max error", "ns/samp", "was");
+	for (int p = 0; p < numChosen; ++p) {
+		const Preset* preset = chosen[p];
+		// the first run is the one checked, the rest only count towards the timing
+		double best = render(preset, in, out, length, sampleRate);
+		float* rerun = (float*)malloc(sizeof(float) * length);
+		for (int run = 1; run < TIMING_RUNS; ++run) {
+			double seconds = render(preset, in, rerun, length, sampleRate);
+			if (seconds < best) {
+				best = seconds;
+			}
+		}
+		free(rerun);
+		double nanos = best * 1e9 / length;
+
+		char path[PATH_LENGTH];
+		snprintf(path, PATH_LENGTH, "%s/%s.wav", GOLDEN_DIR, preset->name);
+		if (update) {
+			WavWriter* writer = WavWriter_open(path, sampleRate);
+			if (writer == NULL || !WavWriter_write(writer, out, length) || !WavWriter_close(writer)) {
+				++failed;
+				continue;
+			}
+			if (timingFile != NULL) {
+				fprintf(timingFile, "%s %.2f\n", preset->name, nanos);
+			}
+			printf("%-10s %9s %10s %9.2f %9s  updated\n", preset->name, "", "", nanos, "");
+			continue;
+		}
+
+		float* golden;
+		int goldenRate;
+		unsigned long goldenLength = loadWav(path, &golden, &goldenRate);
+		if (goldenLength != length || goldenRate != sampleRate) {
+			printf("%-10s no usable golden at %s, run with --update\n", preset->name, path);
+			if (goldenLength > 0) {
+				free(golden);
+			}
+			++failed;
+			continue;
+		}
+		float maxError;
+		double ratio = snr(golden, out, length, &maxError);
+		free(golden);
+		bool accurate = ratio >= minSnr && maxError <= MAX_ERROR;
+		// a preset with no recorded time fails rather than passing unchecked,
+		// unless the timing was turned off
+		double recorded = timing ? loadTiming(preset->name) : 0;
+		bool timed = !timing || recorded > 0;
+		bool fast = recorded == 0 || nanos <= recorded * (1 + slack / 100);
+		char was[16];
+		if (!timing) {
+			snprintf(was, sizeof(was), "-");
+		}
+		else if (!timed) {
+			snprintf(was, sizeof(was), "no timing");
+		}
+		else {
+			snprintf(was, sizeof(was), "%.2f", recorded);
+		}
+		printf("%-10s %9.1f %10.2e %9.2f %9s  %s%s%s\n", preset->name, ratio, maxError, nanos, was,
+			   accurate ? "" : "ACCURACY ", fast ? "" : "SPEED ", timed ? "" : "TIMING ");
+		if (!accurate || !fast || !timed) {
+			++failed;
+		}
+		missingTiming |= !timed;
+	}
+	if (timingFile != NULL) {
+		fclose(timingFile);
+	}
+	free(in);
+	free(out);
+	if (missingTiming) {
+		printf("no recorded timing for some presets, run with --update on the Pi or check with --no-timing\n");
+	}
+	if (failed > 0) {
+		printf("%d of %d failed\n", failed, numChosen);
+		return 1;
+	}
+	printf("all %d passed\n", numChosen);
+	return 0;
+}
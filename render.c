@@ -0,0 +1,208 @@
+/*
+ * BATCH RENDERER
+ * Runs WAV files through effect presets offline, one job for every file and
+ * preset, spread across a pool of worker threads. Each job builds its own
+ * effect chain, so the threads share nothing but the job list, and streams
+ * its input and output a block at a time instead of loading whole files.
+ * Outputs are mono 32 bit float WAVs named <input>_<preset>.wav.
+ *
+ * usage: render [-j threads] [-o outdir] [-p preset,preset...] input.wav...
+ *        render --list
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "math.h"
+#include "time.h"
+
+#include "lutmath.c"
+#include "realtime.c"
+#include "effects.c"
+#include "wav.c"
+#include "presets.c"
+
+#define MAX_PRESETS (32)
+#define PATH_LENGTH (1024)
+
+typedef struct {
+	const char* input;
+	const Preset* preset;
+	char output[PATH_LENGTH];
+
+	bool ok;
+	double seconds;
+	double audioSeconds;
+}
+RenderJob;
+
+typedef struct {
+	RenderJob* jobs;
+	int numJobs;
+	_Atomic int nextJob;
+}
+JobQueue;
+
+static void runJob(RenderJob* job) {
+	double start = nowSeconds();
+	job->ok = false;
+	WavReader* reader = WavReader_open(job->input);
+	if (reader == NULL) {
+		return;
+	}
+	WavWriter* writer = WavWriter_open(job->output, reader->sampleRate);
+	if (writer == NULL) {
+		WavReader_close(reader);
+		return;
+	}
+	Effects* fx = buildEffects(job->preset, reader->sampleRate);
+	float in[RENDER_CHUNK];
+	float out[RENDER_CHUNK];
+	unsigned long frames;
+	unsigned long total = 0;
+	bool ok = true;
+	while (ok && (frames = WavReader_read(reader, in, RENDER_CHUNK)) > 0) {
+		// the chain always sees whole blocks, the tail of the last one is cut off again
+		memset(in + frames, 0, (RENDER_CHUNK - frames) * sizeof(float));
+		Effects_process(fx, in, out, RENDER_CHUNK);
+		ok = WavWriter_write(writer, out, frames);
+		total += frames;
+	}
+	job->audioSeconds = (double)total / reader->sampleRate;
+	Effects_destroy(fx);
+	WavReader_close(reader);
+	job->ok = WavWriter_close(writer) && ok;
+	job->seconds = nowSeconds() - start;
+}
+
+static void* renderWorker(void* _queue) {
+	JobQueue* queue = (JobQueue*)_queue;
+	int index;
+	while ((index = atomic_fetch_add(&queue->nextJob, 1)) < queue->numJobs) {
+		runJob(&queue->jobs[index]);
+	}
+	return NULL;
+}
+
+// "soundfiles/original.wav" with "ambient" in "out" becomes "out/original_ambient.wav"
+static void outputPath(char* out, const char* outDir, const char* input, const char* preset) {
+	const char* name = strrchr(input, '/');
+	name = name != NULL ? name + 1 : input;
+	int length = strlen(name);
+	if (length > 4 && strcmp(name + length - 4, ".wav") == 0) {
+		length -= 4;
+	}
+	snprintf(out, PATH_LENGTH, "%s/%.*s_%s.wav", outDir, length, name, preset);
+}
+
+int main(int argc, char** argv) {
+	int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* outDir = ".";
+	const Preset* chosen[MAX_PRESETS];
+	int numChosen = 0;
+	const char* inputs[argc];
+	int numInputs = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--list") == 0) {
+			for (int p = 0; p < NUM_PRESETS; ++p) {
+				printf("%s\n", presets[p].name);
+			}
+			return 0;
+		}
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			numThreads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			char* list = argv[++i];
+			for (char* name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+				const Preset* preset = findPreset(name);
+				if (preset == NULL) {
+					fprintf(stderr, "unknown preset %s, try --list\n", name);
+					return 1;
+				}
+				if (numChosen < MAX_PRESETS) {
+					chosen[numChosen++] = preset;
+				}
+			}
+		}
+		else {
+			inputs[numInputs++] = argv[i];
+		}
+	}
+	if (numInputs == 0) {
+		fprintf(stderr, "usage: render [-j threads] [-o outdir] [-p preset,preset...] input.wav...\n");
+		return 1;
+	}
+	// no presets given means all of them
+	if (numChosen == 0) {
+		for (int p = 0; p < NUM_PRESETS && p < MAX_PRESETS; ++p) {
+			chosen[numChosen++] = &presets[p];
+		}
+	}
+	if (numThreads < 1) {
+		numThreads = 1;
+	}
+
+	JobQueue queue;
+	queue.numJobs = numInputs * numChosen;
+	queue.jobs = (RenderJob*)malloc(sizeof(RenderJob) * queue.numJobs);
+	atomic_init(&queue.nextJob, 0);
+	for (int i = 0; i < numInputs; ++i) {
+		for (int p = 0; p < numChosen; ++p) {
+			RenderJob* job = &queue.jobs[i * numChosen + p];
+			job->input = inputs[i];
+			job->preset = chosen[p];
+			job->ok = false;
+			job->seconds = 0;
+			job->audioSeconds = 0;
+			outputPath(job->output, outDir, inputs[i], chosen[p]->name);
+		}
+	}
+	if (numThreads > queue.numJobs) {
+		numThreads = queue.numJobs;
+	}
+
+	// the shared tables have to exist before the workers race to build them
+	LutMath_init();
+	Distortion_initTables();
+	double start = nowSeconds();
+	pthread_t threads[numThreads];
+	for (int t = 0; t < numThreads; ++t) {
+		pthread_create(&threads[t], NULL, renderWorker, &queue);
+	}
+	for (int t = 0; t < numThreads; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+	double elapsed = nowSeconds() - start;
+
+	int failed = 0;
+	double audioSeconds = 0;
+	for (int j = 0; j < queue.numJobs; ++j) {
+		RenderJob* job = &queue.jobs[j];
+		if (!job->ok) {
+			printf("FAILED  %s\n", job->output);
+			++failed;
+			continue;
+		}
+		audioSeconds += job->audioSeconds;
+		printf("%6.2f s  %6.1fx realtime  %s\n", job->seconds,
+			   job->seconds > 0 ? job->audioSeconds / job->seconds : 0, job->output);
+	}
+	printf("%d jobs on %d threads in %.2f s, %.1fx realtime overall\n", queue.numJobs,
+		   numThreads, elapsed, elapsed > 0 ? audioSeconds / elapsed : 0);
+	free(queue.jobs);
+	return failed > 0 ? 1 : 0;
+}
@@ -13,6 +13,11 @@ typedef struct {
 	int readIndex;	
 	float average;
 	float lastAverage;
+
+	// for working out how fast the hand is moving
+	uint32_t lastTick;
+	float lastDist;
+	float velocity;
 }
 Sensor;
 
@@ -35,6 +40,9 @@ Sensor* Sensor_create(int _trigPin, int _echoPin, float _minDist, float _maxDist
 	sensor->readIndex = 0;
 	sensor->average = 0;
 	sensor->lastAverage = 0;
+	sensor->lastTick = 0;
+	sensor->lastDist = sensor->maxDist;
+	sensor->velocity = 0;
 
 	gpioSetMode(sensor->trigPin, PI_OUTPUT);
 	gpioSetMode(sensor->echoPin, PI_INPUT);
@@ -85,3 +93,95 @@ int Sensor_getAvgValue(Sensor* sensor, float newDist) {
 	sensor->lastAverage = sensor->average;
 	return sensor->average;
 }
+
+// smoothed hand speed in cm/s from successive readings, negative when moving closer
+float Sensor_getVelocity(Sensor* sensor, float newDist) {
+	uint32_t now = gpioTick();
+	// unsigned subtraction still works when the tick counter wraps
+	float seconds = (now - sensor->lastTick) / 1000000.0f;
+	if (sensor->lastTick != 0 && seconds > 0) {
+		float velocity = (newDist - sensor->lastDist) / seconds;
+		sensor->velocity += (velocity - sensor->velocity) * 0.5f;
+	}
+	sensor->lastTick = now;
+	sensor->lastDist = newDist;
+	return sensor->velocity;
+}
+
+// call when there's no reading, so a hand that left doesn't keep its last speed
+void Sensor_resetVelocity(Sensor* sensor) {
+	sensor->lastTick = 0;
+	sensor->velocity = 0;
+}
+
+// how long a hand can stay in before it's a hold instead of a tap, in microseconds
+#define GESTURE_HOLD_MICROS (800000)
+// how soon a second tap has to follow to count as a double tap
+#define GESTURE_DOUBLE_MICROS (500000)
+
+typedef enum {
+	GESTURE_NONE,
+	GESTURE_TAP,
+	GESTURE_DOUBLE_TAP,
+	GESTURE_HOLD
+}
+GestureType;
+
+// turns a hand dipping in close to a sensor into taps, double taps and holds
+typedef struct {
+	float nearDist;
+	bool down;
+	bool held;
+	// a tap waiting to see whether a second one makes it a double
+	bool pendingTap;
+	uint32_t downTick;
+	uint32_t tapTick;
+}
+Gesture;
+
+Gesture* Gesture_create(float _nearDist) {
+	Gesture* gesture = (Gesture*)malloc(sizeof(Gesture));
+	gesture->nearDist = _nearDist;
+	gesture->down = false;
+	gesture->held = false;
+	gesture->pendingTap = false;
+	gesture->downTick = 0;
+	gesture->tapTick = 0;
+	return gesture;
+}
+
+// feed every reading in, -1 included; a tap is only reported once it can't become a double
+GestureType Gesture_update(Gesture* gesture, float dist) {
+	uint32_t now = gpioTick();
+	bool near = dist != -1 && dist <= gesture->nearDist;
+	if (near && !gesture->down) {
+		gesture->down = true;
+		gesture->held = false;
+		gesture->downTick = now;
+	}
+	else if (near && !gesture->held && now - gesture->downTick >= GESTURE_HOLD_MICROS) {
+		gesture->held = true;
+		gesture->pendingTap = false;
+		return GESTURE_HOLD;
+	}
+	else if (!near && gesture->down) {
+		gesture->down = false;
+		if (!gesture->held) {
+			if (gesture->pendingTap) {
+				gesture->pendingTap = false;
+				return GESTURE_DOUBLE_TAP;
+			}
+			gesture->pendingTap = true;
+			gesture->tapTick = now;
+		}
+	}
+	if (gesture->pendingTap && !gesture->down && now - gesture->tapTick >= GESTURE_DOUBLE_MICROS) {
+		gesture->pendingTap = false;
+		return GESTURE_TAP;
+	}
+	return GESTURE_NONE;
+}
+
+void Gesture_destroy(Gesture* gesture) {
+	free(gesture);
+}
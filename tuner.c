@@ -0,0 +1,143 @@
+/*
+ * CALIBRATION
+ * Sweeps chunk size and PortAudio's suggested latency with the effects running,
+ * counts xruns and callback load at each setting,
+ * and keeps the lowest-latency setting that ran clean.
+ * The result is saved so normal runs can pick it up without re-measuring.
+ */
+#define TUNING_FILE "tuning.cfg"
+#define CALIBRATE_SECONDS (5)
+// a setting only counts as stable if the callback leaves this much of its period spare
+#define MAX_STABLE_LOAD (0.7)
+
+// chunk sizes to try, and suggested latencies as multiples of one chunk
+static const int tuneChunkSizes[] = {32, 64, 128, 256, 512};
+static const int tuneLatencyChunks[] = {1, 2, 4};
+
+// tells whatever the callback runs that its blocks are changing size
+typedef void (*ChunkSizeSetter)(void* data, int chunkSize);
+
+typedef struct {
+	int chunkSize;
+	// suggested latency in seconds, 0 means use the device's default low latency
+	double latency;
+}
+Tuning;
+
+bool Tuning_load(Tuning* tuning, const char* path) {
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+	int chunkSize;
+	double latency;
+	bool ok = fscanf(file, "chunk=%d\nlatency=%lf", &chunkSize, &latency) == 2 && chunkSize > 0;
+	fclose(file);
+	if (ok) {
+		tuning->chunkSize = chunkSize;
+		tuning->latency = latency;
+	}
+	return ok;
+}
+
+bool Tuning_save(Tuning* tuning, const char* path) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "chunk=%d\nlatency=%f\n", tuning->chunkSize, tuning->latency);
+	fclose(file);
+	return true;
+}
+
+PaError openAudioStream(PaStream** stream, int inChannels, int outChannels,
+						int sampleRate, int chunkSize, double latency,
+						PaStreamCallback* callback, void* userData) {
+	PaStreamParameters inParams;
+	inParams.device = Pa_GetDefaultInputDevice();
+	if (inParams.device == paNoDevice) {
+		return paInvalidDevice;
+	}
+	inParams.channelCount = inChannels;
+	inParams.sampleFormat = paFloat32;
+	inParams.suggestedLatency = latency > 0 ? latency :
+		Pa_GetDeviceInfo(inParams.device)->defaultLowInputLatency;
+	inParams.hostApiSpecificStreamInfo = NULL;
+
+	PaStreamParameters outParams;
+	outParams.device = Pa_GetDefaultOutputDevice();
+	if (outParams.device == paNoDevice) {
+		return paInvalidDevice;
+	}
+	outParams.channelCount = outChannels;
+	outParams.sampleFormat = paFloat32;
+	outParams.suggestedLatency = latency > 0 ? latency :
+		Pa_GetDeviceInfo(outParams.device)->defaultLowOutputLatency;
+	outParams.hostApiSpecificStreamInfo = NULL;
+
+	PaError err = Pa_OpenStream(stream, &inParams, &outParams, sampleRate, chunkSize,
+								paNoFlag, callback, userData);
+	if (err == paNoError) {
+		PaAlsa_EnableRealtimeScheduling(*stream, 1);
+	}
+	return err;
+}
+
+// runs the stream at one setting, returns the round trip latency it reported or -1 on failure
+double Tuner_measure(void* data, ChunkSizeSetter setChunkSize, Realtime* rt, PaStreamCallback* callback,
+					 int inChannels, int outChannels, int sampleRate,
+					 int chunkSize, double latency) {
+	PaStream* stream;
+	setChunkSize(data, chunkSize);
+	Realtime_restart(rt, sampleRate, chunkSize);
+	PaError err = openAudioStream(&stream, inChannels, outChannels, sampleRate,
+								  chunkSize, latency, callback, data);
+	if (err != paNoError) {
+		return -1;
+	}
+	const PaStreamInfo* info = Pa_GetStreamInfo(stream);
+	double totalLatency = info->inputLatency + info->outputLatency;
+	err = Pa_StartStream(stream);
+	if (err != paNoError) {
+		Pa_CloseStream(stream);
+		return -1;
+	}
+	Pa_Sleep(CALIBRATE_SECONDS * 1000);
+	Pa_StopStream(stream);
+	Pa_CloseStream(stream);
+	return totalLatency;
+}
+
+// sweeps every setting, returns false if none of them were stable
+// data goes to the callback, and to setChunkSize before each setting
+bool Tuner_run(Tuning* best, void* data, ChunkSizeSetter setChunkSize, Realtime* rt,
+			   PaStreamCallback* callback, int inChannels, int outChannels, int sampleRate) {
+	int numChunks = sizeof(tuneChunkSizes) / sizeof(tuneChunkSizes[0]);
+	int numLatencies = sizeof(tuneLatencyChunks) / sizeof(tuneLatencyChunks[0]);
+	double bestLatency = -1;
+	printf("chunk  suggested  actual    xruns  max load\n");
+	for (int c = 0; c < numChunks; ++c) {
+		for (int l = 0; l < numLatencies; ++l) {
+			int chunkSize = tuneChunkSizes[c];
+			double latency = (double)chunkSize * tuneLatencyChunks[l] / sampleRate;
+			double actual = Tuner_measure(data, setChunkSize, rt, callback, inChannels, outChannels,
+										  sampleRate, chunkSize, latency);
+			if (actual < 0) {
+				printf("%5d  %6.2f ms  could not open stream\n", chunkSize, latency * 1000);
+				continue;
+			}
+			long xruns = Realtime_getXruns(rt);
+			double maxLoad = Realtime_getMaxLoad(rt);
+			bool stable = xruns == 0 && maxLoad < MAX_STABLE_LOAD;
+			printf("%5d  %6.2f ms  %6.2f ms  %5ld  %5.0f%%%s\n",
+				   chunkSize, latency * 1000, actual * 1000, xruns, maxLoad * 100,
+				   stable ? "" : "  (unstable)");
+			if (stable && (bestLatency < 0 || actual < bestLatency)) {
+				bestLatency = actual;
+				best->chunkSize = chunkSize;
+				best->latency = latency;
+			}
+		}
+	}
+	return bestLatency >= 0;
+}
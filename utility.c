@@ -15,11 +15,12 @@ float linearScale(float distance, float minDist, float maxDist, float paramMin,
 	return value;
 }
 
+// like linearScale but even steps in ratio rather than size, needs LutMath_init first
 float logScale(float distance, float minDist, float maxDist, float paramMin, float paramMax) {
-	paramMin = log(paramMin);
-	paramMax = log(paramMax);
+	paramMin = lutLog2(paramMin);
+	paramMax = lutLog2(paramMax);
 	float scale = (paramMax - paramMin) / (maxDist - minDist);
-	return exp(paramMin + scale * (distance - minDist));
+	return lutExp2(paramMin + scale * (distance - minDist));
 }
 
 void queryDevices() {
@@ -66,3 +67,33 @@ int subRange(float distance, float minDist, float maxDist, int numSubranges) {
 	}
 	return -1;
 }
+
+// pitch class of a note name like "A", "F#" or "Bb", 0 for C, -1 if it isn't one
+int parseNoteName(const char* name) {
+	static const int naturals[7] = {9, 11, 0, 2, 4, 5, 7};
+	if (name[0] < 'A' || name[0] > 'G') {
+		return -1;
+	}
+	int pitchClass = naturals[name[0] - 'A'];
+	if (name[1] == '#') {
+		++pitchClass;
+	}
+	else if (name[1] == 'b') {
+		--pitchClass;
+	}
+	else if (name[1] != '\0') {
+		return -1;
+	}
+	return (pitchClass + 12) % 12;
+}
+
+// index of a scale name in the harmonizer's Scale list, -1 if it isn't one
+int parseScaleName(const char* name) {
+	static const char* names[] = {"major", "minor", "harmonic", "dorian", "mixolydian"};
+	for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (strcmp(name, names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,214 @@
+/*
+ * WAV FILES
+ * Just enough of the format for our own recordings and renders:
+ * a plain 44 byte header in front of 32 bit float or 16 bit PCM samples.
+ */
+#define WAV_HEADER_BYTES (44)
+#define WAV_FORMAT_PCM (1)
+#define WAV_FORMAT_FLOAT (3)
+
+static void putLE16(unsigned char* out, uint16_t value) {
+	out[0] = value & 0xff;
+	out[1] = (value >> 8) & 0xff;
+}
+
+static void putLE32(unsigned char* out, uint32_t value) {
+	putLE16(out, value & 0xffff);
+	putLE16(out + 2, value >> 16);
+}
+
+// fills in a header for dataBytes of sample data
+void wavHeader(unsigned char* header, int sampleRate, int channels, int format, uint32_t dataBytes) {
+	int bytesPerSample = format == WAV_FORMAT_FLOAT ? 4 : 2;
+	memcpy(header, "RIFF", 4);
+	putLE32(header + 4, 36 + dataBytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	putLE32(header + 16, 16);
+	putLE16(header + 20, format);
+	putLE16(header + 22, channels);
+	putLE32(header + 24, sampleRate);
+	putLE32(header + 28, sampleRate * channels * bytesPerSample);
+	putLE16(header + 32, channels * bytesPerSample);
+	putLE16(header + 34, bytesPerSample * 8);
+	memcpy(header + 36, "data", 4);
+	putLE32(header + 40, dataBytes);
+}
+
+static uint16_t getLE16(const unsigned char* in) {
+	return in[0] | (in[1] << 8);
+}
+
+static uint32_t getLE32(const unsigned char* in) {
+	return getLE16(in) | ((uint32_t)getLE16(in + 2) << 16);
+}
+
+// bytes of file read per fread, however many frames the caller asks for
+#define WAV_SCRATCH_BYTES (1 << 16)
+#define WAV_FORMAT_EXTENSIBLE (0xfffe)
+
+// streams samples out of a 16 bit PCM or 32 bit float file, mixed down to mono
+typedef struct {
+	FILE* file;
+	int sampleRate;
+	int channels;
+	int format;
+	int bytesPerSample;
+	uint32_t framesLeft;
+	unsigned char* scratch;
+}
+WavReader;
+
+WavReader* WavReader_open(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+	unsigned char header[WAV_HEADER_BYTES];
+	if (fread(header, 1, 12, file) != 12 ||
+		memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+		fprintf(stderr, "%s: not a WAV file\n", path);
+		fclose(file);
+		return NULL;
+	}
+	WavReader* reader = (WavReader*)malloc(sizeof(WavReader));
+	reader->file = file;
+	reader->format = 0;
+	// walk the chunks until the samples, skipping anything we don't care about
+	while (true) {
+		unsigned char chunk[8];
+		if (fread(chunk, 1, 8, file) != 8) {
+			fprintf(stderr, "%s: no data chunk\n", path);
+			fclose(file);
+			free(reader);
+			return NULL;
+		}
+		uint32_t size = getLE32(chunk + 4);
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && size <= sizeof(header)) {
+			if (fread(header, 1, size, file) != size) {
+				break;
+			}
+			reader->format = getLE16(header);
+			reader->channels = getLE16(header + 2);
+			reader->sampleRate = getLE32(header + 4);
+			reader->bytesPerSample = getLE16(header + 14) / 8;
+			// the real format code is the start of the subformat GUID
+			if (reader->format == WAV_FORMAT_EXTENSIBLE && size >= 26) {
+				reader->format = getLE16(header + 24);
+			}
+			if (size & 1) {
+				fseek(file, 1, SEEK_CUR);
+			}
+		}
+		else if (memcmp(chunk, "data", 4) == 0) {
+			reader->framesLeft = reader->format ? size / (reader->channels * reader->bytesPerSample) : 0;
+			break;
+		}
+		else {
+			// chunks are padded to an even length
+			fseek(file, size + (size & 1), SEEK_CUR);
+		}
+	}
+	bool pcm16 = reader->format == WAV_FORMAT_PCM && reader->bytesPerSample == 2;
+	bool float32 = reader->format == WAV_FORMAT_FLOAT && reader->bytesPerSample == 4;
+	if (!pcm16 && !float32) {
+		fprintf(stderr, "%s: only 16 bit PCM and 32 bit float are supported\n", path);
+		fclose(file);
+		free(reader);
+		return NULL;
+	}
+	reader->scratch = (unsigned char*)malloc(WAV_SCRATCH_BYTES);
+	return reader;
+}
+
+// returns how many frames went into out, less than asked for only at the end of the file
+unsigned long WavReader_read(WavReader* reader, float* out, unsigned long frames) {
+	size_t frameBytes = reader->channels * reader->bytesPerSample;
+	unsigned long done = 0;
+	while (done < frames && reader->framesLeft > 0) {
+		unsigned long count = frames - done;
+		if (count > WAV_SCRATCH_BYTES / frameBytes) {
+			count = WAV_SCRATCH_BYTES / frameBytes;
+		}
+		if (count > reader->framesLeft) {
+			count = reader->framesLeft;
+		}
+		count = fread(reader->scratch, frameBytes, count, reader->file);
+		if (count == 0) {
+			reader->framesLeft = 0;
+			break;
+		}
+		for (unsigned long i = 0; i < count; ++i) {
+			const unsigned char* frame = reader->scratch + i * frameBytes;
+			float sum = 0;
+			for (int c = 0; c < reader->channels; ++c) {
+				if (reader->format == WAV_FORMAT_FLOAT) {
+					uint32_t bits = getLE32(frame + c * 4);
+					float sample;
+					memcpy(&sample, &bits, sizeof(sample));
+					sum += sample;
+				}
+				else {
+					sum += (int16_t)getLE16(frame + c * 2) / 32768.0f;
+				}
+			}
+			out[done + i] = sum / reader->channels;
+		}
+		done += count;
+		reader->framesLeft -= count;
+	}
+	return done;
+}
+
+void WavReader_close(WavReader* reader) {
+	fclose(reader->file);
+	free(reader->scratch);
+	free(reader);
+}
+
+// streams mono 32 bit float samples into a file, the header is filled in on close
+typedef struct {
+	FILE* file;
+	int sampleRate;
+	uint32_t dataBytes;
+	char* buffer;
+}
+WavWriter;
+
+WavWriter* WavWriter_open(const char* path, int _sampleRate) {
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+	WavWriter* writer = (WavWriter*)malloc(sizeof(WavWriter));
+	writer->file = file;
+	writer->sampleRate = _sampleRate;
+	writer->dataBytes = 0;
+	// big sequential writes rather than stdio's default few KB
+	writer->buffer = (char*)malloc(WAV_SCRATCH_BYTES);
+	setvbuf(file, writer->buffer, _IOFBF, WAV_SCRATCH_BYTES);
+	unsigned char header[WAV_HEADER_BYTES] = {0};
+	fwrite(header, 1, WAV_HEADER_BYTES, file);
+	return writer;
+}
+
+// samples go out as they are in memory, which is little endian on everything we run on
+bool WavWriter_write(WavWriter* writer, const float* samples, unsigned long frames) {
+	if (fwrite(samples, sizeof(float), frames, writer->file) != frames) {
+		return false;
+	}
+	writer->dataBytes += frames * sizeof(float);
+	return true;
+}
+
+bool WavWriter_close(WavWriter* writer) {
+	unsigned char header[WAV_HEADER_BYTES];
+	wavHeader(header, writer->sampleRate, 1, WAV_FORMAT_FLOAT, writer->dataBytes);
+	bool ok = fseek(writer->file, 0, SEEK_SET) == 0 &&
+			  fwrite(header, 1, WAV_HEADER_BYTES, writer->file) == WAV_HEADER_BYTES;
+	ok = fclose(writer->file) == 0 && ok;
+	free(writer->buffer);
+	free(writer);
+	return ok;
+}